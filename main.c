@@ -2,127 +2,1067 @@
 #include <string.h>
 #include <stdlib.h>	
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <strings.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdarg.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#endif
 
 //------------------------------------------------------------------------------------------------------
 // Constants
 
 
 // Define constant values
-#define ROOM_COUNT 50
-#define MAX_PATIENT_COUNT 50
-#define MAX_USER_COUNT 50
+#define ROOM_COUNT 50 // number of rooms made by generate_data
+#define ROOM_WARD_SPAN 100 // room numbers within a ward, room 1204 is room 4 of ward 12
 #define STRING_MAX_LEN 50
+#define DATA_FILE_PATH "hospital.dat"
+#define JOURNAL_FILE_PATH "hospital.journal"
+#define AUDIT_FILE_PATH "hospital.audit"
+#define HISTORY_FILE_PATH "hospital.history"
+#define HISTORY_OPEN_FILE_PATH "hospital.history.open"
 
 char S_SEPARATOR[] = "-------------------------------------------------------------------------";
 char S_CANCELLED[] = "Operation cancelled";
 
 // Define validation constants
-char VALID_USERNAME_CHARS[] = "_";
-char VALID_USERNAME_NUM_ALLOWED=1;
-char VALID_USERNAME_MESSAGE[] = "alphanumeric characters or underscores";
-char VALID_USERNAME_MIN_LEN = 5;
-char VALID_USERNAME_MAX_LEN = 40;
-
-char VALID_PASSWORD_CHARS[] = "_!@#$\%^&*";
-char VALID_PASSWORD_NUM_ALLOWED=1;
-char VALID_PASSWORD_MESSAGE[] = "alphanumeric characters or any of [!@#$\%^&*]";
-char VALID_PASSWORD_MIN_LEN = 8;
-char VALID_PASSWORD_MAX_LEN = 40;
-
-char VALID_PATIENT_CHARS[] = "";
-char VALID_PATIENT_NUM_ALLOWED=0;
-char VALID_PATIENT_MESSAGE[] = "alphabetic characters";
-char VALID_PATIENT_MIN_LEN = 1;
-char VALID_PATIENT_MAX_LEN = 20;
+// Each field's allowed characters are a 256-bit table (bit c set when byte c is allowed),
+// worked out by the compiler from these ranges, so checking a character is a single bit test.
+// CLASS_RANGE gives the part of a range that falls in one 64-bit word of the table.
+#define CLASS_RANGE(first,last,word) (((first) > (word)*64+63 || (last) < (word)*64) ? 0ULL \
+	: (~0ULL << ((first) > (word)*64 ? (first)-(word)*64 : 0)) & (~0ULL >> ((last) < (word)*64+63 ? (word)*64+63-(last) : 0)))
+#define CLASS_CHAR(c,word) CLASS_RANGE(c,c,word)
+#define CLASS_ALPHA(word) (CLASS_RANGE('A','Z',word) | CLASS_RANGE('a','z',word))
+#define CLASS_DIGIT(word) CLASS_RANGE('0','9',word)
+
+#define USERNAME_CLASS(word) (CLASS_ALPHA(word) | CLASS_DIGIT(word) | CLASS_CHAR('_',word))
+#define PASSWORD_CLASS(word) (CLASS_ALPHA(word) | CLASS_DIGIT(word) | CLASS_CHAR('_',word) | CLASS_CHAR('!',word) \
+	| CLASS_CHAR('@',word) | CLASS_CHAR('#',word) | CLASS_CHAR('$',word) | CLASS_CHAR('%',word) \
+	| CLASS_CHAR('^',word) | CLASS_CHAR('&',word) | CLASS_CHAR('*',word))
+#define PATIENT_CLASS(word) CLASS_ALPHA(word)
+
+// the vector check splits a character into its nibbles, for each low nibble a row holds
+// one bit per (ascii) high nibble
+#define CLASS_HAS(class,c) ((class((c)/64) >> ((c)%64)) & 1)
+#define CLASS_NIBBLE_ROW(class,low) (CLASS_HAS(class,low) | CLASS_HAS(class,16+low)<<1 | CLASS_HAS(class,32+low)<<2 \
+	| CLASS_HAS(class,48+low)<<3 | CLASS_HAS(class,64+low)<<4 | CLASS_HAS(class,80+low)<<5 \
+	| CLASS_HAS(class,96+low)<<6 | CLASS_HAS(class,112+low)<<7)
+#define CLASS_TABLES(class) \
+	.chars = {class(0),class(1),class(2),class(3)}, \
+	.nibble_rows = { \
+		CLASS_NIBBLE_ROW(class,0),CLASS_NIBBLE_ROW(class,1),CLASS_NIBBLE_ROW(class,2),CLASS_NIBBLE_ROW(class,3), \
+		CLASS_NIBBLE_ROW(class,4),CLASS_NIBBLE_ROW(class,5),CLASS_NIBBLE_ROW(class,6),CLASS_NIBBLE_ROW(class,7), \
+		CLASS_NIBBLE_ROW(class,8),CLASS_NIBBLE_ROW(class,9),CLASS_NIBBLE_ROW(class,10),CLASS_NIBBLE_ROW(class,11), \
+		CLASS_NIBBLE_ROW(class,12),CLASS_NIBBLE_ROW(class,13),CLASS_NIBBLE_ROW(class,14),CLASS_NIBBLE_ROW(class,15)}
+
+struct StringRule {
+	unsigned long long chars[4];
+	unsigned char nibble_rows[16];
+	char min_length;
+	char max_length;
+	char *message; // describes the allowed characters
+};
+
+struct StringRule VALID_USERNAME = {
+	CLASS_TABLES(USERNAME_CLASS),
+	.message = "alphanumeric characters or underscores",
+	.min_length = 5,
+	.max_length = 40,
+};
+
+struct StringRule VALID_PASSWORD = {
+	CLASS_TABLES(PASSWORD_CLASS),
+	.message = "alphanumeric characters or any of [!@#$\%^&*]",
+	.min_length = 8,
+	.max_length = 40,
+};
+
+struct StringRule VALID_PATIENT = {
+	CLASS_TABLES(PATIENT_CLASS),
+	.message = "alphabetic characters",
+	.min_length = 1,
+	.max_length = 20,
+};
 
 // Enums
 enum Privs {NOPRV,ADMIN,STAFF,GUEST,};
 char PrivsToS[4][20] = {"No Privelage","Admin","Staff","Guest"};
 
-enum RoomStatus {VACANT,FULL};
-char RoomStatusToS[2][20] = {"Vacant","Full"};
+enum RoomStatus {VACANT,FULL,RESERVED};
+char RoomStatusToS[3][20] = {"Vacant","Full","Reserved"};
 
 enum PatientStatus {VISIT,RECOVER,ILL,SEVERE,DISMISSED};
 char PatientStatusToS[5][20] = {"Visit","Recover","Ill","Severe","Dismissed"};
 
+// names are kept once in the string arena and records refer to them, see String Arena
+struct StringRef {
+	unsigned int offset; // in bytes from the start of the arena
+	unsigned int length; // without the terminating zero, 0 for the empty string
+};
+
 // Define User struct and default values
+#define USER_SALT_LEN 16
+#define USER_HASH_LEN 32
+
 struct User {
-	char name[STRING_MAX_LEN];
-	char password[STRING_MAX_LEN]; //passwords shouldn't be saved in plain text, add some encoding maybe?
+	struct StringRef name;
+	unsigned char salt[USER_SALT_LEN]; // random per user, so equal passwords don't share a hash
+	unsigned char password_hash[USER_HASH_LEN]; // sha-256 of the salt followed by the password
 	enum Privs privilege;
 } 
-NOT_A_USER = {.privilege = NOPRV, .name = "", .password = ""}, // for failed login attempts
-GUEST_USER = {.privilege = GUEST, .name = "", .password = ""}, // for guest allowed actions
-ROOT_ADMIN = {.privilege = ADMIN, .name = "", .password = ""}; // for when there is no admin present (initial setup)
+NOT_A_USER = {.privilege = NOPRV}, // for failed login attempts
+GUEST_USER = {.privilege = GUEST}, // for guest allowed actions
+ROOT_ADMIN = {.privilege = ADMIN}; // for when there is no admin present (initial setup)
 
-// Define Room struct
-struct Room {
-	unsigned char id;
-	unsigned int patient_id;
-	enum RoomStatus status;
+// Define Room and Patient columns
+// rooms and patients are stored field by field, each field in its own array, so a scan
+// over one field (every room's status, every patient's id) only reads that field's bytes
+enum RoomColumn {
+	ROOM_ID, // unsigned int, numbered by ward, see Wards
+	ROOM_PATIENT_ID, // unsigned int
+	ROOM_STATUS, // unsigned char holding an enum RoomStatus, only changed atomically, see room_reserve
+	ROOM_COLUMN_COUNT,
 };
 
-// Define Patient struct
-struct Patient {
-	char name[STRING_MAX_LEN];
-	unsigned int id;
-	enum PatientStatus status;
+enum PatientColumn {
+	PATIENT_ID, // unsigned int
+	PATIENT_STATUS, // unsigned char holding an enum PatientStatus
+	PATIENT_ROOM_INDEX, // unsigned int, reverse link to the patient's room, UINT_MAX when not admitted
+	PATIENT_NAME, // struct StringRef, only followed when a name is shown
+	PATIENT_COLUMN_COUNT,
+};
+
+
+//------------------------------------------------------------------------------------------------------
+// Console Output
+
+
+// Everything printed is collected in one buffer and written with a single write when
+// the program is about to wait for input, exits, or the buffer fills, so a whole screen
+// (or a whole batch of results) goes out at once instead of one write per line.
+// In quiet mode decorations (titles, separators, blank lines) and progress notes are
+// left out, leaving only prompts, messages and results.
+#define OUTPUT_BUFFER_SIZE 65536
+
+struct {
+	char quiet;
+	pthread_mutex_t mutex; // server workers can report errors too
+	unsigned int used;
+	char buffer[OUTPUT_BUFFER_SIZE];
+} output = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// called with the mutex held
+void out_write_buffer(){
+	unsigned int written = 0;
+	while (written < output.used){
+		ssize_t result = write(STDOUT_FILENO,output.buffer+written,output.used-written);
+		if (result < 0 && errno == EINTR) continue;
+		if (result <= 0) break; // nowhere to print to, drop the text
+		written += result;
+	}
+	output.used = 0;
+}
+
+void out_flush(){
+	pthread_mutex_lock(&output.mutex);
+	out_write_buffer();
+	pthread_mutex_unlock(&output.mutex);
+}
+
+// called with the mutex held, text longer than the whole buffer is cut short
+void out_append(char *text, unsigned int length){
+	if (output.used+length > OUTPUT_BUFFER_SIZE) out_write_buffer();
+	if (length > OUTPUT_BUFFER_SIZE) length = OUTPUT_BUFFER_SIZE;
+	memcpy(output.buffer+output.used,text,length);
+	output.used += length;
+}
+
+// prints a line, like puts
+void out_s(char *line){
+	pthread_mutex_lock(&output.mutex);
+	out_append(line,strlen(line));
+	out_append("\n",1);
+	pthread_mutex_unlock(&output.mutex);
+}
+
+// prints formatted text, like printf
+void out_f(char *format, ...){
+	va_list args;
+	pthread_mutex_lock(&output.mutex);
+	for (int attempt=0; attempt<2; attempt++){
+		unsigned int space = OUTPUT_BUFFER_SIZE-output.used;
+		va_start(args,format);
+		int result = vsnprintf(output.buffer+output.used,space,format,args);
+		va_end(args);
+		if (result < 0) break;
+		unsigned int length = result;
+		// retry once in an emptied buffer when it didn't fit
+		if (length < space || output.used == 0){
+			output.used += length < space ? length : space-1;
+			break;
+		}
+		out_write_buffer();
+	}
+	pthread_mutex_unlock(&output.mutex);
+}
+
+// prints a line that is only there to lay out the screen
+void out_decoration(char *line){
+	if (output.quiet == 0) out_s(line);
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Operation Statistics
+
+
+// Every operation, whether it comes from a menu, the batch mode or a server client, is
+// counted with its failures and a histogram of how long it took. Each thread adds to its
+// own counters, so nothing is shared on the hot path, and readers add up all threads.
+// Histogram bucket i holds the latencies in [2^(i-1), 2^i) ns, so a percentile is known
+// to within a factor of two. Menu operations include the time spent at the prompts.
+// With --stats <file> the table is also written to a file every few seconds.
+#define STATS_BUCKET_COUNT 40 // the last bucket holds everything from about 9 minutes up
+#define STATS_DUMP_INTERVAL_S 10
+#define STATS_TEXT_LEN 4096
+
+enum Operation {OP_LOGIN,OP_GUEST,OP_VIEW,OP_SEARCH,OP_EMPTY_ROOMS,OP_CENSUS,OP_HISTORY,OP_TRANSITIONS,OP_STATS,
+	OP_REGISTER,OP_SET_STATUS,OP_ADMIT,OP_TRANSFER,OP_ADMIT_BATCH,OP_DISCHARGE,OP_REGISTER_USER,OP_COUNT};
+char OperationToS[OP_COUNT][16] = {"login","guest","view","search","empty-rooms","census","history","transitions",
+	"stats","register","set-status","admit","transfer","admit-batch","discharge","register-user"};
+
+struct OperationStats {
+	unsigned long long count;
+	unsigned long long failures;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long buckets[STATS_BUCKET_COUNT];
+};
+
+struct ThreadStats {
+	struct OperationStats operations[OP_COUNT];
+	struct ThreadStats *next;
+};
+
+struct {
+	pthread_mutex_t mutex; // guards the list of threads, the counters are only written by their thread
+	struct ThreadStats *threads;
+	char *dump_path; // NULL when not dumping
+	pthread_mutex_t dump_mutex;
+	time_t started;
+} stats = {.mutex = PTHREAD_MUTEX_INITIALIZER, .dump_mutex = PTHREAD_MUTEX_INITIALIZER};
+
+__thread struct ThreadStats *thread_stats; // kept for as long as the program runs
+
+long long monotonic_ns(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (long long)now.tv_sec*1000000000LL + now.tv_nsec;
+}
+
+// only the owning thread writes, the atomic store keeps readers from seeing a torn value
+void stats_add(unsigned long long *counter, unsigned long long amount){
+	__atomic_store_n(counter,*counter+amount,__ATOMIC_RELAXED);
+}
+
+// called with the monotonic_ns taken when the operation started
+void stats_record(enum Operation operation, long long start, char failed){
+	long long elapsed = monotonic_ns()-start;
+	if (elapsed < 0) elapsed = 0;
+	if (thread_stats == NULL){
+		thread_stats = calloc(1,sizeof(struct ThreadStats));
+		if (thread_stats == NULL) return;
+		pthread_mutex_lock(&stats.mutex);
+		thread_stats->next = stats.threads;
+		stats.threads = thread_stats;
+		pthread_mutex_unlock(&stats.mutex);
+	}
+	struct OperationStats *op = &thread_stats->operations[operation];
+	unsigned int bucket = elapsed == 0 ? 0 : 64-__builtin_clzll(elapsed);
+	if (bucket >= STATS_BUCKET_COUNT) bucket = STATS_BUCKET_COUNT-1;
+	stats_add(&op->count,1);
+	if (failed) stats_add(&op->failures,1);
+	stats_add(&op->total_ns,elapsed);
+	if ((unsigned long long)elapsed > op->max_ns) __atomic_store_n(&op->max_ns,elapsed,__ATOMIC_RELAXED);
+	stats_add(&op->buckets[bucket],1);
+}
+
+// adds up the counters of every thread
+void stats_collect(struct OperationStats *totals){
+	memset(totals,0,sizeof(struct OperationStats)*OP_COUNT);
+	pthread_mutex_lock(&stats.mutex);
+	for (struct ThreadStats *thread = stats.threads; thread != NULL; thread = thread->next){
+		for (int i=0; i<OP_COUNT; i++){
+			struct OperationStats *op = &thread->operations[i];
+			totals[i].count += __atomic_load_n(&op->count,__ATOMIC_RELAXED);
+			totals[i].failures += __atomic_load_n(&op->failures,__ATOMIC_RELAXED);
+			totals[i].total_ns += __atomic_load_n(&op->total_ns,__ATOMIC_RELAXED);
+			unsigned long long max_ns = __atomic_load_n(&op->max_ns,__ATOMIC_RELAXED);
+			if (max_ns > totals[i].max_ns) totals[i].max_ns = max_ns;
+			for (int b=0; b<STATS_BUCKET_COUNT; b++) totals[i].buckets[b] += __atomic_load_n(&op->buckets[b],__ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&stats.mutex);
+}
+
+// the upper end of the bucket holding the given percentile, in ns, never above the slowest one seen
+unsigned long long stats_percentile(struct OperationStats *op, unsigned int percent){
+	unsigned long long rank = (op->count*percent+99)/100;
+	unsigned long long seen = 0;
+	for (int b=0; b<STATS_BUCKET_COUNT-1; b++){
+		seen += op->buckets[b];
+		if (seen >= rank && seen > 0) return (1ULL << b) < op->max_ns ? 1ULL << b : op->max_ns;
+	}
+	return op->max_ns;
+}
+
+// one line per operation that ran at least once, latencies in microseconds
+void stats_format(char *text, size_t size){
+	struct OperationStats totals[OP_COUNT];
+	stats_collect(totals);
+	int length = snprintf(text,size,"%-14s %10s %10s %12s %12s %12s %12s\n",
+		"operation","count","failed","mean us","p50 us","p99 us","max us");
+	for (int i=0; i<OP_COUNT && length < (int)size; i++){
+		struct OperationStats *op = &totals[i];
+		if (op->count == 0) continue;
+		length += snprintf(text+length,size-length,"%-14s %10llu %10llu %12.1f %12.1f %12.1f %12.1f\n",
+			OperationToS[i],op->count,op->failures,op->total_ns/1e3/op->count,
+			stats_percentile(op,50)/1e3,stats_percentile(op,99)/1e3,op->max_ns/1e3);
+	}
+}
+
+// replaces the dump file in one step, so readers never see half of it
+void stats_dump(){
+	char text[STATS_TEXT_LEN];
+	char temporary_path[PATH_MAX];
+	if (stats.dump_path == NULL) return;
+	stats_format(text,sizeof(text));
+	snprintf(temporary_path,sizeof(temporary_path),"%s.tmp",stats.dump_path);
+	pthread_mutex_lock(&stats.dump_mutex);
+	FILE *file = fopen(temporary_path,"w");
+	if (file != NULL){
+		fprintf(file,"# operations since %s",ctime(&stats.started));
+		fputs(text,file);
+		if (fclose(file) == 0) rename(temporary_path,stats.dump_path);
+	}
+	pthread_mutex_unlock(&stats.dump_mutex);
+}
+
+void* stats_dump_thread(void *argument){
+	(void)argument;
+	while (0==0){
+		sleep(STATS_DUMP_INTERVAL_S);
+		stats_dump();
+	}
+	return NULL;
+}
+
+// starts writing the statistics to a file, and once more on exit
+void stats_start_dump(char *path){
+	pthread_t thread;
+	stats.dump_path = path;
+	if (pthread_create(&thread,NULL,stats_dump_thread,NULL) != 0) return;
+	pthread_detach(thread);
+	atexit(stats_dump);
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Record Storage
+
+
+// Records are kept in fixed-size slabs that are allocated once and never moved,
+// so a record's index works as a stable handle and pointers to it stay valid
+// while the table grows. Growing only allocates one slab per TABLE_SLAB_RECORDS records.
+// Each column of a table has its own slabs, so within a slab a column is a plain array
+// that a loop can run through (and the compiler vectorize) without touching other fields.
+#define TABLE_SLAB_SHIFT 12
+#define TABLE_SLAB_RECORDS (1u<<TABLE_SLAB_SHIFT) // 4096 records per slab
+#define TABLE_MAX_SLABS 4096 // up to 16M records per table
+#define TABLE_MAX_COLUMNS 4
+
+struct Table {
+	void *slabs[TABLE_MAX_COLUMNS][TABLE_MAX_SLABS];
+	unsigned int slab_count; // the same for every column
+	unsigned int count;
+	unsigned int column_count;
+	unsigned int column_sizes[TABLE_MAX_COLUMNS];
+	unsigned int file_slot; // position of the table's first column in the data file header
+	unsigned char view_dirty[TABLE_MAX_SLABS]; // slabs written since the last read view was copied
+};
+
+// defined prototype before declaration
+void* data_file_alloc_slab(struct Table *table, unsigned int column);
+void data_file_sync_count(struct Table *table);
+char data_file_is_open();
+
+void* table_at(struct Table *table, unsigned int column, unsigned int index){
+	return (char*)table->slabs[column][index>>TABLE_SLAB_SHIFT] + (size_t)(index&(TABLE_SLAB_RECORDS-1))*table->column_sizes[column];
+}
+
+// number of records in use in one slab, for scans that walk a column slab by slab
+unsigned int table_slab_used(struct Table *table, unsigned int slab){
+	if (slab+1 < table->slab_count) return TABLE_SLAB_RECORDS;
+	return table->count - (slab<<TABLE_SLAB_SHIFT);
+}
+
+// adds a zeroed record and returns its handle, UINT_MAX if there is no memory (or no room
+// in the data file) left
+unsigned int table_append(struct Table *table){
+	if ((table->count>>TABLE_SLAB_SHIFT) == table->slab_count){
+		if (table->slab_count == TABLE_MAX_SLABS) return UINT_MAX;
+		for (unsigned int column=0; column<table->column_count; column++){
+			// slabs come from the data file when one is open, otherwise from the heap, never
+			// from the heap when the data file is full since those records would never be saved.
+			// A column that already got its slab keeps it, the next append retries the rest
+			if (table->slabs[column][table->slab_count] != NULL) continue;
+			void *slab = data_file_is_open() ? data_file_alloc_slab(table,column) : calloc(TABLE_SLAB_RECORDS,table->column_sizes[column]);
+			if (slab == NULL) return UINT_MAX;
+			table->slabs[column][table->slab_count] = slab;
+		}
+		table->slab_count++;
+	}
+	unsigned int index = table->count++;
+	for (unsigned int column=0; column<table->column_count; column++){
+		memset(table_at(table,column,index),0,table->column_sizes[column]);
+	}
+	__atomic_store_n(&table->view_dirty[index>>TABLE_SLAB_SHIFT],1,__ATOMIC_RELAXED);
+	data_file_sync_count(table);
+	return index;
+}
+
+// copies every column of one record over another
+void table_copy_record(struct Table *table, unsigned int to, unsigned int from){
+	for (unsigned int column=0; column<table->column_count; column++){
+		memcpy(table_at(table,column,to),table_at(table,column,from),table->column_sizes[column]);
+	}
+	__atomic_store_n(&table->view_dirty[to>>TABLE_SLAB_SHIFT],1,__ATOMIC_RELAXED);
+}
+
+// frees every slab of a heap backed table, never used on tables in the data file
+void table_clear(struct Table *table){
+	for (unsigned int column=0; column<table->column_count; column++){
+		for (unsigned int i=0; i<table->slab_count; i++){
+			free(table->slabs[column][i]);
+			table->slabs[column][i] = NULL;
+		}
+	}
+	table->slab_count = 0;
+	table->count = 0;
+	memset(table->view_dirty,1,sizeof(table->view_dirty));
+}
+
+struct Table rooms = {
+	.column_count = ROOM_COLUMN_COUNT,
+	.column_sizes = {sizeof(unsigned int),sizeof(unsigned int),sizeof(unsigned char)},
+	.file_slot = 0,
+};
+struct Table patients = {
+	.column_count = PATIENT_COLUMN_COUNT,
+	.column_sizes = {sizeof(unsigned int),sizeof(unsigned char),sizeof(unsigned int),sizeof(struct StringRef)},
+	.file_slot = ROOM_COLUMN_COUNT,
+};
+struct Table users = {
+	.column_count = 1,
+	.column_sizes = {sizeof(struct User)},
+	.file_slot = ROOM_COLUMN_COUNT+PATIENT_COLUMN_COUNT,
+};
+#define STRING_ARENA_LINE 64
+struct Table strings = {
+	.column_count = 1,
+	.column_sizes = {STRING_ARENA_LINE},
+	.file_slot = ROOM_COLUMN_COUNT+PATIENT_COLUMN_COUNT+1,
+};
+
+unsigned int* room_id_at(unsigned int index){
+	return table_at(&rooms,ROOM_ID,index);
+}
+
+unsigned int* room_patient_id_at(unsigned int index){
+	return table_at(&rooms,ROOM_PATIENT_ID,index);
+}
+
+unsigned char* room_status_at(unsigned int index){
+	return table_at(&rooms,ROOM_STATUS,index);
+}
+
+unsigned int* patient_id_at(unsigned int index){
+	return table_at(&patients,PATIENT_ID,index);
+}
+
+unsigned char* patient_status_at(unsigned int index){
+	return table_at(&patients,PATIENT_STATUS,index);
+}
+
+unsigned int* patient_room_index_at(unsigned int index){
+	return table_at(&patients,PATIENT_ROOM_INDEX,index);
+}
+
+struct StringRef* patient_name_ref_at(unsigned int index){
+	return table_at(&patients,PATIENT_NAME,index);
+}
+
+// defined prototype before declaration
+char* string_at(struct StringRef ref);
+
+char* patient_name_at(unsigned int index){
+	return string_at(*patient_name_ref_at(index));
+}
+
+struct User* user_at(unsigned int index){
+	return table_at(&users,0,index);
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Data File
+
+
+// The data file is a header followed by table slabs, and is mapped into memory
+// so the tables point straight into it. Records are used in place (no parsing or
+// copying on load) and every change to a record is written back through the mapping.
+// New slabs are appended to the end of the file as the tables grow.
+// Every column of every table has its own entry in the header.
+// The version must be increased whenever the layout of a record or the header changes.
+#define DATA_FILE_MAGIC "HOSPDAT"
+#define DATA_FILE_VERSION 5
+#define DATA_FILE_TABLE_COUNT 4
+#define DATA_FILE_COLUMN_COUNT (ROOM_COLUMN_COUNT+PATIENT_COLUMN_COUNT+2)
+
+enum DataFileState {DATA_FILE_FAILED,DATA_FILE_CREATED,DATA_FILE_LOADED};
+
+struct DataFileColumn {
+	unsigned int record_size;
+	unsigned int count;
+	unsigned int slab_count;
+	unsigned int reserved;
+	unsigned long long slab_offsets[TABLE_MAX_SLABS];
+};
+
+struct DataFileHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int column_count;
+	unsigned long long file_size;
+	unsigned int string_arena_used; // bytes of the strings table in use
+	unsigned int reserved;
+	struct DataFileColumn columns[DATA_FILE_COLUMN_COUNT];
+};
+
+// header size rounded up to a page, so every slab starts page aligned
+#define DATA_FILE_HEADER_SIZE ((sizeof(struct DataFileHeader)+4095)/4096*4096)
+
+struct {
+	int fd;
+	struct DataFileHeader *header; // NULL when running without a data file
+} data_file = {.fd = -1, .header = NULL};
+
+char data_file_is_open(){
+	return data_file.header != NULL;
+}
+
+void* data_file_alloc_slab(struct Table *table, unsigned int column){
+	if (data_file.header == NULL) return NULL;
+	unsigned long long offset = data_file.header->file_size;
+	size_t size = (size_t)TABLE_SLAB_RECORDS*table->column_sizes[column]; // always a multiple of the page size
+	// extend the file (new space reads as zeros) and map only the new slab. The space is
+	// allocated up front, so a full disk fails here rather than on a write through the mapping
+	if (posix_fallocate(data_file.fd,offset,size) != 0){
+		if (ftruncate(data_file.fd,offset) != 0) out_s("Failed to shrink the data file back");
+		return NULL;
+	}
+	void *slab = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,data_file.fd,offset);
+	if (slab == MAP_FAILED){
+		// the header's size has to keep matching the file
+		if (ftruncate(data_file.fd,offset) != 0) out_s("Failed to shrink the data file back");
+		return NULL;
+	}
+
+	struct DataFileColumn *file_column = &data_file.header->columns[table->file_slot+column];
+	file_column->slab_offsets[file_column->slab_count++] = offset;
+	data_file.header->file_size = offset+size;
+	return slab;
+}
+
+void data_file_sync_count(struct Table *table){
+	if (data_file.header == NULL) return;
+	for (unsigned int column=0; column<table->column_count; column++){
+		data_file.header->columns[table->file_slot+column].count = table->count;
+	}
+}
+
+struct Table* data_file_tables[DATA_FILE_TABLE_COUNT] = {&rooms,&patients,&users,&strings};
+
+// maps an existing data file, or creates an empty one that the tables will fill
+enum DataFileState data_file_open(char *path){
+	int fd = open(path,O_RDWR|O_CREAT,0600);
+	if (fd < 0){
+		out_f("Failed to open the data file %s\n",path);
+		return DATA_FILE_FAILED;
+	}
+	struct stat file_stat;
+	if (fstat(fd,&file_stat) != 0){
+		close(fd);
+		return DATA_FILE_FAILED;
+	}
+
+	// new file, write an empty header
+	if (file_stat.st_size == 0){
+		if (ftruncate(fd,DATA_FILE_HEADER_SIZE) != 0){
+			close(fd);
+			return DATA_FILE_FAILED;
+		}
+		struct DataFileHeader *header = mmap(NULL,DATA_FILE_HEADER_SIZE,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+		if (header == MAP_FAILED){
+			close(fd);
+			return DATA_FILE_FAILED;
+		}
+		memcpy(header->magic,DATA_FILE_MAGIC,sizeof(header->magic));
+		header->version = DATA_FILE_VERSION;
+		header->column_count = DATA_FILE_COLUMN_COUNT;
+		header->file_size = DATA_FILE_HEADER_SIZE;
+		for (int i=0; i<DATA_FILE_TABLE_COUNT; i++){
+			struct Table *table = data_file_tables[i];
+			for (unsigned int column=0; column<table->column_count; column++){
+				header->columns[table->file_slot+column].record_size = table->column_sizes[column];
+			}
+		}
+		data_file.fd = fd;
+		data_file.header = header;
+		return DATA_FILE_CREATED;
+	}
+
+	// existing file, map it whole and check it matches this build
+	struct DataFileHeader *header = mmap(NULL,file_stat.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	if (header == MAP_FAILED){
+		close(fd);
+		return DATA_FILE_FAILED;
+	}
+	char valid = ((unsigned long long)file_stat.st_size >= DATA_FILE_HEADER_SIZE)
+		&& memcmp(header->magic,DATA_FILE_MAGIC,sizeof(header->magic)) == 0
+		&& header->version == DATA_FILE_VERSION
+		&& header->column_count == DATA_FILE_COLUMN_COUNT
+		&& header->file_size == (unsigned long long)file_stat.st_size
+		&& header->string_arena_used <= (unsigned long long)header->columns[strings.file_slot].count*STRING_ARENA_LINE;
+	for (int i=0; valid && i<DATA_FILE_TABLE_COUNT; i++){
+		struct Table *table = data_file_tables[i];
+		struct DataFileColumn *first = &header->columns[table->file_slot];
+		for (unsigned int column=0; valid && column<table->column_count; column++){
+			struct DataFileColumn *file_column = &header->columns[table->file_slot+column];
+			// every column of a table holds the same records, though a column can have
+			// one spare slab when growing the others failed
+			valid = file_column->record_size == table->column_sizes[column]
+				&& file_column->count == first->count
+				&& file_column->slab_count <= TABLE_MAX_SLABS
+				&& file_column->count <= file_column->slab_count*TABLE_SLAB_RECORDS;
+			// every slab must lie whole inside the file, after the header
+			unsigned long long slab_size = (unsigned long long)TABLE_SLAB_RECORDS*table->column_sizes[column];
+			for (unsigned int j=0; valid && j<file_column->slab_count; j++){
+				unsigned long long offset = file_column->slab_offsets[j];
+				valid = offset >= DATA_FILE_HEADER_SIZE
+					&& offset <= header->file_size
+					&& slab_size <= header->file_size-offset;
+			}
+		}
+	}
+	if (valid == 0){
+		if ((unsigned long long)file_stat.st_size >= DATA_FILE_HEADER_SIZE && memcmp(header->magic,DATA_FILE_MAGIC,sizeof(header->magic)) == 0
+			&& header->version != DATA_FILE_VERSION)
+			out_f("Data file %s is version %u, this build only reads version %u\n",path,header->version,DATA_FILE_VERSION);
+		else out_f("Data file %s is damaged\n",path);
+		munmap(header,file_stat.st_size);
+		close(fd);
+		return DATA_FILE_FAILED;
+	}
+
+	// point every table's slabs straight into the mapping
+	for (int i=0; i<DATA_FILE_TABLE_COUNT; i++){
+		struct Table *table = data_file_tables[i];
+		table->slab_count = TABLE_MAX_SLABS;
+		table->count = header->columns[table->file_slot].count;
+		for (unsigned int column=0; column<table->column_count; column++){
+			struct DataFileColumn *file_column = &header->columns[table->file_slot+column];
+			// spare slabs are kept too, table_append uses them before allocating more
+			for (unsigned int j=0; j<file_column->slab_count; j++){
+				table->slabs[column][j] = (char*)header + file_column->slab_offsets[j];
+			}
+			if (file_column->slab_count < table->slab_count) table->slab_count = file_column->slab_count;
+		}
+	}
+	data_file.fd = fd;
+	data_file.header = header;
+	return DATA_FILE_LOADED;
+}
+
+void data_file_sync(){
+	if (data_file.header == NULL) return;
+	// dirty mapped pages live in the page cache, fsync writes them out with the rest of the file
+	fsync(data_file.fd);
+}
+
+void data_file_close(){
+	if (data_file.header == NULL) return;
+	data_file_sync();
+	close(data_file.fd);
+	data_file.fd = -1;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// String Arena
+
+
+// Patient and user names are appended to an arena once and never moved or removed, and
+// records keep a StringRef (offset and length, 8 bytes) instead of a STRING_MAX_LEN buffer.
+// Strings are stored zero terminated, so a name is used straight from the arena.
+// The arena is a table of STRING_ARENA_LINE byte records in the data file like the others,
+// a string never crosses a slab so it is always in one piece, and the number of bytes
+// in use is kept in the data file header.
+// Patient names are interned: a name already in the arena is referred to again instead of
+// being added twice, found through a hash index that is rebuilt from the patients on load.
+// User names are unique to begin with, so they are only appended.
+#define STRING_ARENA_SLAB_BYTES (TABLE_SLAB_RECORDS*STRING_ARENA_LINE)
+#define STRING_INDEX_MIN_CAPACITY 64
+
+struct StringSlot {
+	unsigned int hash;
+	unsigned int offset; // UINT_MAX marks an empty slot
+};
+
+struct {
+	unsigned int used; // bytes
+	struct StringSlot *index;
+	unsigned int index_capacity; // always a power of two
+	unsigned int index_used;
+} string_arena;
+
+char* string_arena_at(unsigned int offset){
+	return (char*)table_at(&strings,0,offset/STRING_ARENA_LINE) + offset%STRING_ARENA_LINE;
+}
+
+char* string_at(struct StringRef ref){
+	if (ref.length == 0) return "";
+	return string_arena_at(ref.offset);
+}
+
+// copies the string to the end of the arena, returns 0 when the arena can't grow
+char string_append(char *string, struct StringRef *ref){
+	unsigned int length = strnlen(string,STRING_MAX_LEN-1);
+	*ref = (struct StringRef){0,0};
+	if (length == 0) return 1;
+	unsigned int offset = string_arena.used;
+	// the rest of a slab too short for the string is left as padding
+	if (offset/STRING_ARENA_SLAB_BYTES != (offset+length)/STRING_ARENA_SLAB_BYTES)
+		offset = (offset+length)/STRING_ARENA_SLAB_BYTES*STRING_ARENA_SLAB_BYTES;
+	while ((unsigned long long)strings.count*STRING_ARENA_LINE < offset+length+1){
+		if (table_append(&strings) == UINT_MAX) return 0;
+	}
+	memcpy(string_arena_at(offset),string,length);
+	string_arena_at(offset)[length] = 0;
+	string_arena.used = offset+length+1;
+	if (data_file.header != NULL) data_file.header->string_arena_used = string_arena.used;
+	ref->offset = offset;
+	ref->length = length;
+	return 1;
+}
+
+// defined prototype before declaration
+unsigned int hash_name(char *name);
+
+// returns the slot holding the string, or the empty slot where it should be placed
+struct StringSlot* string_index_probe(struct StringSlot *slots, unsigned int capacity, char *string, unsigned int hash){
+	unsigned int mask = capacity-1;
+	unsigned int slot = hash & mask;
+	while (slots[slot].offset != UINT_MAX
+		&& (slots[slot].hash != hash || strcmp(string_arena_at(slots[slot].offset),string) != 0)){
+		slot = (slot+1) & mask;
+	}
+	return &slots[slot];
+}
+
+char string_index_resize(unsigned int capacity){
+	struct StringSlot *slots = malloc(sizeof(struct StringSlot)*capacity);
+	if (slots == NULL) return 0;
+	memset(slots,0xFF,sizeof(struct StringSlot)*capacity); // every slot starts empty
+
+	// re-insert all used slots into the new table, the strings are already unique
+	for (unsigned int i=0; i<string_arena.index_capacity; i++){
+		if (string_arena.index[i].offset == UINT_MAX) continue;
+		unsigned int slot = string_arena.index[i].hash & (capacity-1);
+		while (slots[slot].offset != UINT_MAX) slot = (slot+1) & (capacity-1);
+		slots[slot] = string_arena.index[i];
+	}
+	free(string_arena.index);
+	string_arena.index = slots;
+	string_arena.index_capacity = capacity;
+	return 1;
+}
+
+// makes ref refer to an equal string already in the arena, or to a new copy of it
+char string_intern(char *string, struct StringRef *ref){
+	char truncated[STRING_MAX_LEN];
+	unsigned int length = strnlen(string,STRING_MAX_LEN-1);
+	if (length == 0){
+		*ref = (struct StringRef){0,0};
+		return 1;
+	}
+	if (string[length] != 0){
+		memcpy(truncated,string,length);
+		truncated[length] = 0;
+		string = truncated;
+	}
+	// keep the load factor under 1/2 so probe sequences stay short
+	if ((string_arena.index_used+1)*2 > string_arena.index_capacity){
+		unsigned int capacity = string_arena.index_capacity*2;
+		if (capacity < STRING_INDEX_MIN_CAPACITY) capacity = STRING_INDEX_MIN_CAPACITY;
+		if (string_index_resize(capacity)==0) return string_append(string,ref); // still correct, only not shared
+	}
+	unsigned int hash = hash_name(string);
+	struct StringSlot *slot = string_index_probe(string_arena.index,string_arena.index_capacity,string,hash);
+	if (slot->offset != UINT_MAX){
+		*ref = (struct StringRef){slot->offset,length};
+		return 1;
+	}
+	if (string_append(string,ref)==0) return 0;
+	slot->hash = hash;
+	slot->offset = ref->offset;
+	string_arena.index_used++;
+	return 1;
+}
+
+// rebuild the intern index after the patients table was loaded or filled in bulk
+char string_index_rebuild(){
+	free(string_arena.index);
+	string_arena.index = NULL;
+	string_arena.index_capacity = 0;
+	string_arena.index_used = 0;
+	unsigned int capacity = STRING_INDEX_MIN_CAPACITY;
+	while (capacity < patients.count*2) capacity *= 2;
+	if (string_index_resize(capacity)==0){
+		out_s("Failed to allocate memory for the name index");
+		return 0;
+	}
+	for (unsigned int i=0; i<patients.count; i++){
+		struct StringRef *ref = patient_name_ref_at(i);
+		if (ref->length == 0) continue;
+		char *name = string_at(*ref);
+		unsigned int hash = hash_name(name);
+		struct StringSlot *slot = string_index_probe(string_arena.index,string_arena.index_capacity,name,hash);
+		if (slot->offset != UINT_MAX) continue;
+		slot->hash = hash;
+		slot->offset = ref->offset;
+		string_arena.index_used++;
+	}
+	return 1;
+}
+
+// picks up the arena of a loaded data file
+char string_arena_load(){
+	string_arena.used = data_file.header->string_arena_used;
+	return string_index_rebuild();
+}
+
+// empties the arena and its index, for tables that are cleared and filled again
+void string_arena_clear(){
+	table_clear(&strings);
+	string_arena.used = 0;
+	free(string_arena.index);
+	string_arena.index = NULL;
+	string_arena.index_capacity = 0;
+	string_arena.index_used = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Password Hashing
+
+
+// Passwords are never stored, only a sha-256 hash of a random salt followed by the
+// password. Checking a password hashes it the same way and compares every byte of
+// the hash, so the time taken doesn't tell how much of it matched.
+unsigned int SHA256_K[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2,
 };
 
+#define ROTR32(x,n) (((x) >> (n)) | ((x) << (32-(n))))
+
+void sha256_block(unsigned int state[8], unsigned char *block){
+	unsigned int w[64], v[8];
+	for (int i=0; i<16; i++){
+		w[i] = (unsigned int)block[4*i]<<24 | block[4*i+1]<<16 | block[4*i+2]<<8 | block[4*i+3];
+	}
+	for (int i=16; i<64; i++){
+		unsigned int s0 = ROTR32(w[i-15],7) ^ ROTR32(w[i-15],18) ^ (w[i-15] >> 3);
+		unsigned int s1 = ROTR32(w[i-2],17) ^ ROTR32(w[i-2],19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	memcpy(v,state,sizeof(v));
+	for (int i=0; i<64; i++){
+		unsigned int t1 = v[7] + (ROTR32(v[4],6) ^ ROTR32(v[4],11) ^ ROTR32(v[4],25))
+			+ ((v[4] & v[5]) ^ (~v[4] & v[6])) + SHA256_K[i] + w[i];
+		unsigned int t2 = (ROTR32(v[0],2) ^ ROTR32(v[0],13) ^ ROTR32(v[0],22))
+			+ ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(v+1,v,sizeof(unsigned int)*7);
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (int i=0; i<8; i++) state[i] += v[i];
+}
+
+// hashes data that fits in a few blocks, which is all a salted password needs
+void sha256(unsigned char *data, unsigned int length, unsigned char hash[USER_HASH_LEN]){
+	unsigned int state[8] = {0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19};
+	unsigned char block[64];
+	unsigned long long bit_length = (unsigned long long)length*8;
+	while (length >= 64){
+		sha256_block(state,data);
+		data += 64;
+		length -= 64;
+	}
+	// pad with a single set bit, zeros and the message length in bits
+	memset(block,0,sizeof(block));
+	memcpy(block,data,length);
+	block[length] = 0x80;
+	if (length >= 56){
+		sha256_block(state,block);
+		memset(block,0,sizeof(block));
+	}
+	for (int i=0; i<8; i++) block[63-i] = bit_length >> (8*i);
+	sha256_block(state,block);
+	for (int i=0; i<8; i++){
+		hash[4*i] = state[i] >> 24;
+		hash[4*i+1] = state[i] >> 16;
+		hash[4*i+2] = state[i] >> 8;
+		hash[4*i+3] = state[i];
+	}
+}
+
+void password_hash(unsigned char salt[USER_SALT_LEN], char *password, unsigned char hash[USER_HASH_LEN]){
+	unsigned char salted[USER_SALT_LEN+STRING_MAX_LEN];
+	unsigned int length = strnlen(password,STRING_MAX_LEN);
+	memcpy(salted,salt,USER_SALT_LEN);
+	memcpy(salted+USER_SALT_LEN,password,length);
+	sha256(salted,USER_SALT_LEN+length,hash);
+}
+
+// gives the user a new random salt and the hash of password with it
+void user_set_password(struct User *user, char *password){
+	if (getentropy(user->salt,USER_SALT_LEN) != 0){
+		// no system randomness, a unique salt is still better than none
+		for (int i=0; i<USER_SALT_LEN; i++) user->salt[i] = rand() ^ (time(NULL) >> (i%4*8));
+	}
+	password_hash(user->salt,password,user->password_hash);
+}
+
+// compares the whole hash whatever the first difference, so timing reveals nothing
+char user_check_password(struct User *user, char *password){
+	unsigned char hash[USER_HASH_LEN];
+	unsigned char difference = 0;
+	password_hash(user->salt,password,hash);
+	for (int i=0; i<USER_HASH_LEN; i++) difference |= hash[i] ^ user->password_hash[i];
+	return difference == 0;
+}
+
 
 //------------------------------------------------------------------------------------------------------
 // Initial Data
 
 
-// Define available users
-struct User users[MAX_USER_COUNT] = {
+// Define default users, their passwords are hashed when they are added
+struct {
+	struct User user;
+	char *name;
+	char *password;
+} DEFAULT_USERS[] = {
 	{
-		.privilege = STAFF,
+		.user = {.privilege = STAFF},
 		.name = "John",
 		.password = "$avingLives1by1",
 	},
 	{
-		.privilege = ADMIN, // remove completely or switch privelege to STAFF to test root user
+		.user = {.privilege = ADMIN}, // remove completely or switch privelege to STAFF to test root user
 		.name = "a",
 		.password = "a",
 	},
 };
-unsigned char user_count = 2;
 
-// Define available rooms
-struct Room rooms[ROOM_COUNT];
+// defined prototype before declaration
+unsigned int user_add(struct User *user);
+
+void load_default_users(){
+	for (size_t i=0; i<sizeof(DEFAULT_USERS)/sizeof(DEFAULT_USERS[0]); i++){
+		struct User user = DEFAULT_USERS[i].user;
+		if (string_append(DEFAULT_USERS[i].name,&user.name)==0) return;
+		user_set_password(&user,DEFAULT_USERS[i].password);
+		if (user_add(&user) == UINT_MAX) return;
+	}
+}
 
-// Define available patients
-struct Patient patients[MAX_PATIENT_COUNT];
-unsigned char patient_count = 0;
+// defined prototype before declaration
+char patient_id_index_insert(unsigned int patient_id, unsigned int patient_index);
+char name_index_add(unsigned int patient_index);
+void room_indexes_rebuild();
 
 // Generate fake data for testing purposes
 // Can be switched over to loading data in from a file later
 void generate_data(){
 	for (int i=0; i<ROOM_COUNT; i++){
-		rooms[i].id = i;
+		unsigned int room_index = table_append(&rooms);
+		if (room_index == UINT_MAX) break;
+		*room_id_at(room_index) = (i/10+1)*ROOM_WARD_SPAN + i%10+1; // ten rooms to a ward
 		if (i%10<5){
-			patient_count;
-			patients[patient_count].id = 200000+1000*(patient_count)+(rand()%1000); // formula for semi-random unique IDs
-			strcpy(patients[patient_count].name,"Patient");
+			unsigned int patient_index = table_append(&patients);
+			if (patient_index == UINT_MAX) break;
+			unsigned int patient_id = 200000+1000*(patient_index)+(rand()%1000); // formula for semi-random unique IDs
+			char name[STRING_MAX_LEN] = "Patient";
+			*patient_id_at(patient_index) = patient_id;
 			// set last 2 characters to patient index
-			patients[patient_count].name[7] = ((patient_count/10)%10) +'0';
-			patients[patient_count].name[8] = (patient_count%10) +'0';
-			patients[patient_count].name[9] = 0;
-			patients[patient_count].status = (rand())%4;
+			name[7] = ((patient_index/10)%10) +'0';
+			name[8] = (patient_index%10) +'0';
+			name[9] = 0;
+			if (string_intern(name,patient_name_ref_at(patient_index))==0){
+				patients.count--;
+				break;
+			}
+			*patient_status_at(patient_index) = (rand())%4;
 
 			// print id and name for debug purposes
-			printf("[ %u | %s\t%s\t ] Room: %d\n",
-			patients[patient_count].id,patients[patient_count].name,PatientStatusToS[patients[patient_count].status],rooms[i].id);
+			if (output.quiet == 0) out_f("[ %u | %s\t%s\t ] Room: %u\n",
+			patient_id,name,PatientStatusToS[*patient_status_at(patient_index)],*room_id_at(room_index));
 
-			rooms[i].patient_id = patients[patient_count].id;
-			rooms[i].status = FULL;
-			patient_count++;
+			*room_patient_id_at(room_index) = patient_id;
+			*room_status_at(room_index) = FULL;
+			*patient_room_index_at(patient_index) = room_index;
+			patient_id_index_insert(patient_id,patient_index);
+			name_index_add(patient_index);
 		}
 		else{
-			rooms[i].status = VACANT;
+			*room_status_at(room_index) = VACANT;
 		}	
 	}
+	room_indexes_rebuild();
 }
 
 
@@ -131,33 +1071,47 @@ void generate_data(){
 
 
 void title(char *string){
-	puts("");
-	puts(S_SEPARATOR);
+	if (output.quiet) return;
+	out_decoration("");
+	out_decoration(S_SEPARATOR);
 	char title[50];
 	strcpy(title,string);
-	printf("[  %s  ]\n",strupr(title));
-	puts("");
+	for (int i=0; title[i] != '\0'; i++) title[i] = toupper((unsigned char)title[i]);
+	out_f("[  %s  ]\n",title);
+	out_decoration("");
 }
 
 // defined prototype before declaration
-unsigned char patient_room_index_from_id(unsigned int patient_id);
+struct ReadView* read_view_pin();
+void read_view_unpin();
+unsigned char view_patient_status(struct ReadView *view, unsigned int patient_index);
+unsigned int view_patient_room_index(struct ReadView *view, unsigned int patient_index);
+void history_display(unsigned int patient_index);
 
 // Data Display 
-void display_patient_data(unsigned char patient_index){
-	struct Patient patient = patients[patient_index];
-	char patient_room_index = patient_room_index_from_id(patient.id);
-
-	puts("");
-	puts(S_SEPARATOR);
-
-	printf("Patient ID:\t%u\n"	, patient.id);
-	printf("Name:\t\t%s\n"		, patient.name);
-	printf("Status:\t\t%s\n"		, PatientStatusToS[patient.status]);
-	if (patient.status!=DISMISSED)
-		printf("room id:\t%d\n"		, rooms[patient_room_index].id);
+void display_patient_data(unsigned int patient_index){
+	// read through a view so a transfer running at the same time is seen whole or not at all
+	struct ReadView *view = read_view_pin();
+	if (view == NULL){
+		out_s("Failed to read the patient data");
+		return;
+	}
+	unsigned int patient_room_index = view_patient_room_index(view,patient_index);
+	enum PatientStatus status = view_patient_status(view,patient_index);
+	read_view_unpin();
+
+	out_decoration("");
+	out_decoration(S_SEPARATOR);
+
+	out_f("Patient ID:\t%u\n"	, *patient_id_at(patient_index));
+	out_f("Name:\t\t%s\n"		, patient_name_at(patient_index));
+	out_f("Status:\t\t%s\n"		, PatientStatusToS[status]);
+	if (status!=DISMISSED)
+		out_f("room id:\t%u\n"		, *room_id_at(patient_room_index));
+	history_display(patient_index);
 	
-	puts(S_SEPARATOR);
-	puts("");
+	out_decoration(S_SEPARATOR);
+	out_decoration("");
 	
 }
 
@@ -170,7 +1124,8 @@ void display_patient_data(unsigned char patient_index){
 char* prompt_buffer(){
 	// Used to buffer an input up to some amount of characters
 	static char buffer[256]; // static to allow pointer return value
-	printf("> ");
+	out_f("> ");
+	out_flush(); // the screen is complete once input is needed
 	fgets(buffer,256,stdin); // fgets to ensure no buffer overflow
 	buffer[strcspn(buffer, "\n")] = 0; // switch linebreak character of buffer to terminator (common issue with fgets)
 	return buffer;
@@ -203,24 +1158,67 @@ char prompt_y(){
 }
 
 // String Validation
-char validate_string(char *string, char min_length, char max_length,char *valid_chars,char valid_num_allowed, char *valid_chars_text){
+int invalid_char_index_scalar(unsigned char *string, unsigned int length, struct StringRule *rule){
+	for (unsigned int index=0; index<length; index++){
+		if (((rule->chars[string[index]/64] >> (string[index]%64)) & 1) == 0) return index;
+	}
+	return -1;
+}
 
-	// Check for invalid characters
-	int index=0;
-	while (string[index]!=0){ //check for null character
-		if ((!isalpha(string[index]))
-			&& (valid_num_allowed == 0 || !isdigit(string[index])) 
-			&& (strchr(valid_chars,string[index]) == NULL)){ // if character not in valid characters
-			printf("The input must only consist of %s\n",valid_chars_text);
-			printf("The character [%c] is not allowed\n",string[index]);
-			return 0;
+#if defined(__x86_64__) || defined(__i386__)
+// checks 16 characters per step: the low nibble of each character picks its row of the
+// class, the high nibble picks the bit in that row, both with a byte shuffle
+// characters from 128 up pick no bit at all, so only ascii classes can use this
+__attribute__((target("ssse3")))
+int invalid_char_index_vector(unsigned char *string, unsigned int length, struct StringRule *rule){
+	__m128i rows = _mm_loadu_si128((__m128i*)rule->nibble_rows);
+	__m128i high_bits = _mm_setr_epi8(1,2,4,8,16,32,64,-128,0,0,0,0,0,0,0,0);
+	__m128i nibble_mask = _mm_set1_epi8(0x0F);
+	unsigned char tail[16];
+	for (unsigned int index=0; index<length; index+=16){
+		__m128i bytes;
+		unsigned int lanes = 0xFFFF;
+		if (length-index >= 16) bytes = _mm_loadu_si128((__m128i*)(string+index));
+		else{
+			// never read past the end of the string, the padding lanes are masked off
+			memset(tail,0,sizeof(tail));
+			memcpy(tail,string+index,length-index);
+			bytes = _mm_loadu_si128((__m128i*)tail);
+			lanes = (1u << (length-index))-1;
 		}
-		index++;
+		__m128i row = _mm_shuffle_epi8(rows,_mm_and_si128(bytes,nibble_mask));
+		__m128i bit = _mm_shuffle_epi8(high_bits,_mm_and_si128(_mm_srli_epi16(bytes,4),nibble_mask));
+		__m128i allowed = _mm_and_si128(row,bit);
+		unsigned int invalid = _mm_movemask_epi8(_mm_cmpeq_epi8(allowed,_mm_setzero_si128())) & lanes;
+		if (invalid != 0) return index + __builtin_ctz(invalid);
+	}
+	return -1;
+}
+#endif
+
+// returns the index of the first character that isn't allowed, -1 if all of them are
+int invalid_char_index(char *string, unsigned int length, struct StringRule *rule){
+#if defined(__x86_64__) || defined(__i386__)
+	if ((rule->chars[2] | rule->chars[3]) == 0 && __builtin_cpu_supports("ssse3"))
+		return invalid_char_index_vector((unsigned char*)string,length,rule);
+#endif
+	return invalid_char_index_scalar((unsigned char*)string,length,rule);
+}
+
+char validate_string(char *string, struct StringRule *rule){
+	int length = strlen(string);
+
+	// Check for invalid characters
+	int index = invalid_char_index(string,length,rule);
+	if (index != -1){
+		out_f("The input must only consist of %s\n",rule->message);
+		out_f("The character [%c] is not allowed\n",string[index]);
+		return 0;
 	}
 
 	// Check length
-	if (index<min_length || index>max_length){
-		printf("input must be %d to %d characters\n",min_length,max_length);
+	if (length<rule->min_length || length>rule->max_length){
+		out_f("input must be %d to %d characters\n",rule->min_length,rule->max_length);
 		return 0;
 	}
 	return 1;
@@ -231,608 +1229,5149 @@ char validate_string(char *string, char min_length, char max_length,char *valid_
 // Indexing Utility Functions
 
 
-unsigned char room_index_from_id(unsigned char id){
-	for (int i=0; i<ROOM_COUNT; i++){
-		if (rooms[i].id==id) return i;
-	}
-	return UCHAR_MAX;
+// Census Counters
+// kept up to date by every change, so reading them never scans the tables
+// changes to different patients run side by side, so the counters only change atomically
+// room counts are kept per ward, see Wards
+struct {
+	unsigned int patients_by_status[DISMISSED+1];
+	unsigned long long admissions; // since start
+	unsigned long long discharges; // since start
+} census;
+
+void census_add(unsigned int *counter, int amount){
+	__atomic_fetch_add(counter,amount,__ATOMIC_RELAXED);
 }
 
-unsigned char patient_room_index_from_id(unsigned int patient_id){
-	for (int i=0; i<ROOM_COUNT; i++){
-		if (rooms[i].status == FULL && rooms[i].patient_id == patient_id) return i;
-	}
-	return UCHAR_MAX;
+// Wards
+// Rooms are sharded into wards by their id, numbered the way the building is: room 1204
+// is room 4 of ward 12. Each ward keeps its own vacancy bitmap and count on cache lines
+// of its own, so admissions in different wards never write the same memory, and the
+// room's number within the ward is its bit. Claiming a room stays a compare-and-swap of
+// its status (see Room Reservations), which is finer than any lock on the ward.
+// A second bitmap over the wards marks the ones with a vacant room, so a search for a
+// room anywhere skips the full wards 64 at a time.
+// The vacant and occupied totals are striped by ward over a few cache lines, few enough
+// to add up on every read and enough that wards rarely share one.
+#define VACANCY_WORD_BITS 64
+#define WARD_VACANCY_WORDS ((ROOM_WARD_SPAN+VACANCY_WORD_BITS-1)/VACANCY_WORD_BITS)
+#define WARD_COUNTER_STRIPES 64
+
+struct Ward {
+	unsigned long long vacancy_bits[WARD_VACANCY_WORDS]; // bit n set while room n is vacant
+	unsigned int vacant_count; // the bits and count only change atomically
+	unsigned int room_indexes[ROOM_WARD_SPAN]; // UINT_MAX where the ward has no such room
+} __attribute__((aligned(64)));
+
+struct WardCounters {
+	unsigned int vacant_rooms;
+	unsigned int occupied_rooms;
+} __attribute__((aligned(64)));
+
+struct Ward *wards = NULL;
+unsigned int *ward_ids = NULL; // sorted, apart from the wards so a lookup only reads ids
+unsigned int ward_count = 0;
+unsigned long long *ward_vacancy_bits = NULL;
+struct WardCounters ward_counters[WARD_COUNTER_STRIPES];
+// the ward index times ROOM_WARD_SPAN plus the room's number in it, for every room,
+// UINT_MAX for a room whose id was already taken
+unsigned int *room_ward_slots = NULL;
+
+int compare_unsigned_int(const void *a, const void *b){
+	unsigned int x = *(unsigned int*)a, y = *(unsigned int*)b;
+	return (x > y) - (x < y);
 }
 
-unsigned char patient_index_from_id(unsigned int patient_id){
-	for (int i=0; i<patient_count; i++){
-		if (patients[i].id == patient_id) return i;
-	}
-	return UCHAR_MAX;
+int compare_unsigned_long_long(const void *a, const void *b){
+	unsigned long long x = *(unsigned long long*)a, y = *(unsigned long long*)b;
+	return (x > y) - (x < y);
 }
 
-unsigned int user_index_from_name(char *name){
-	for (int i=0; i<user_count; i++){
-		if (strcmp(name, users[i].name)==0){
-			return i;
-			break;
-		}
+unsigned int ward_index_from_id(unsigned int ward_id){
+	unsigned int low = 0, high = ward_count;
+	while (low < high){
+		unsigned int middle = (low+high)/2;
+		if (ward_ids[middle] < ward_id) low = middle+1;
+		else high = middle;
 	}
-	return UINT_MAX;
+	if (low == ward_count || ward_ids[low] != ward_id) return UINT_MAX;
+	return low;
 }
 
-//------------------------------------------------------------------------------------------------------
-// Room Operations
-
+// rebuild the wards after the rooms table was filled in bulk
+// any reservation left in the data file belonged to a run that has ended, so it is released
+void room_indexes_rebuild(){
+	// every ward id once, in order
+	unsigned int *ids = malloc(sizeof(unsigned int)*(rooms.count+1));
+	unsigned int *room_slots = malloc(sizeof(unsigned int)*(rooms.count+1));
+	if (ids == NULL || room_slots == NULL){
+		free(ids);
+		free(room_slots);
+		out_s("Failed to allocate memory for the wards");
+		return;
+	}
+	for (unsigned int i=0; i<rooms.count; i++) ids[i] = *room_id_at(i)/ROOM_WARD_SPAN;
+	qsort(ids,rooms.count,sizeof(unsigned int),compare_unsigned_int);
+	unsigned int count = 0;
+	for (unsigned int i=0; i<rooms.count; i++){
+		if (count == 0 || ids[count-1] != ids[i]) ids[count++] = ids[i];
+	}
+	struct Ward *new_wards = aligned_alloc(64,sizeof(struct Ward)*(count+1));
+	unsigned long long *bits = calloc(count/VACANCY_WORD_BITS+1,sizeof(unsigned long long));
+	if (new_wards == NULL || bits == NULL){
+		free(ids);
+		free(room_slots);
+		free(new_wards);
+		free(bits);
+		out_s("Failed to allocate memory for the wards");
+		return;
+	}
+	memset(new_wards,0,sizeof(struct Ward)*count);
+	for (unsigned int i=0; i<count; i++) memset(new_wards[i].room_indexes,0xFF,sizeof(new_wards[i].room_indexes));
+	free(wards);
+	free(ward_ids);
+	free(room_ward_slots);
+	free(ward_vacancy_bits);
+	wards = new_wards;
+	ward_ids = ids;
+	ward_count = count;
+	room_ward_slots = room_slots;
+	ward_vacancy_bits = bits;
+	memset(ward_counters,0,sizeof(ward_counters));
 
-void find_vacant_room(char *room_id,char *room_index){
-	// pick a room
-	while (0==0){
-		title("room selection menu");
-		puts("Please enter new room ID");
-		*room_id = prompt_d();
-		*room_index = room_index_from_id(*room_id);
-		if (*room_index == UCHAR_MAX){
-			puts("Incorrect room ID");
-			puts("Reselect room? (y)");
-			if (prompt_y()==1) continue;
-			return;
+	unsigned int ward_index = 0;
+	for (unsigned int i=0; i<rooms.count; i++){
+		unsigned int id = *room_id_at(i);
+		unsigned char *status = room_status_at(i);
+		if (*status == RESERVED) *status = VACANT;
+		// rooms mostly come ward by ward, so the last room's ward is tried before searching
+		if (ward_ids[ward_index] != id/ROOM_WARD_SPAN) ward_index = ward_index_from_id(id/ROOM_WARD_SPAN);
+		struct Ward *ward = &wards[ward_index];
+		// a repeated id (imports drop them) keeps its first room, the others are left out of the ward
+		if (ward->room_indexes[id%ROOM_WARD_SPAN] != UINT_MAX){
+			room_ward_slots[i] = UINT_MAX;
+			continue;
 		}
-		if (rooms[*room_index].status==FULL){
-			puts("Room currently full");
-			puts("Reselect room? (y)");
-			if (prompt_y()==1) continue;
-			return;
+		ward->room_indexes[id%ROOM_WARD_SPAN] = i;
+		room_ward_slots[i] = ward_index*ROOM_WARD_SPAN + id%ROOM_WARD_SPAN;
+		struct WardCounters *counters = &ward_counters[ward_index%WARD_COUNTER_STRIPES];
+		if (*status == VACANT){
+			ward->vacancy_bits[(id%ROOM_WARD_SPAN)/VACANCY_WORD_BITS] |= 1ULL << (id%ROOM_WARD_SPAN%VACANCY_WORD_BITS);
+			if (ward->vacant_count++ == 0) ward_vacancy_bits[ward_index/VACANCY_WORD_BITS] |= 1ULL << (ward_index%VACANCY_WORD_BITS);
+			counters->vacant_rooms++;
 		}
-		break;
+		if (*status == FULL) counters->occupied_rooms++;
 	}
 }
 
-void check_empty_rooms(){
-	unsigned char empty_room_count = 0;
-	unsigned char room_id = UCHAR_MAX; // assuming no more than 254 rooms
-	for (int i=0; i<ROOM_COUNT; i++){
-		if (rooms[i].status == VACANT){
-			empty_room_count++;
-			if (room_id == UCHAR_MAX)
-				room_id = rooms[i].id;
-		}
+// the bits and count follow the room's status word, which is what actually claims the room
+void room_vacancy_changed(unsigned int room_index, char is_vacant){
+	unsigned int slot = room_ward_slots[room_index];
+	if (slot == UINT_MAX) return;
+	unsigned int ward_index = slot/ROOM_WARD_SPAN, number = slot%ROOM_WARD_SPAN;
+	struct Ward *ward = &wards[ward_index];
+	unsigned int *vacant_rooms = &ward_counters[ward_index%WARD_COUNTER_STRIPES].vacant_rooms;
+	unsigned long long bit = 1ULL << (number%VACANCY_WORD_BITS);
+	unsigned long long *word = &ward->vacancy_bits[number/VACANCY_WORD_BITS];
+	unsigned long long ward_bit = 1ULL << (ward_index%VACANCY_WORD_BITS);
+	unsigned long long *ward_word = &ward_vacancy_bits[ward_index/VACANCY_WORD_BITS];
+	if (is_vacant){
+		__atomic_fetch_or(word,bit,__ATOMIC_RELEASE);
+		__atomic_fetch_add(vacant_rooms,1,__ATOMIC_RELAXED);
+		if (__atomic_fetch_add(&ward->vacant_count,1,__ATOMIC_ACQ_REL) == 0)
+			__atomic_fetch_or(ward_word,ward_bit,__ATOMIC_RELEASE);
 	}
-	puts(S_SEPARATOR);
-	if (empty_room_count == 0){
-		puts("There are no empty rooms available");
-		prompt_c();
-		return;
+	else{
+		__atomic_fetch_and(word,~bit,__ATOMIC_RELEASE);
+		__atomic_fetch_sub(vacant_rooms,1,__ATOMIC_RELAXED);
+		if (__atomic_sub_fetch(&ward->vacant_count,1,__ATOMIC_ACQ_REL) == 0){
+			__atomic_fetch_and(ward_word,~ward_bit,__ATOMIC_RELEASE);
+			// a room of the ward freed meanwhile may have set the ward's bit just before it was cleared
+			if (__atomic_load_n(&ward->vacant_count,__ATOMIC_ACQUIRE) != 0)
+				__atomic_fetch_or(ward_word,ward_bit,__ATOMIC_RELEASE);
+		}
 	}
-	printf("There are %d rooms available, the first of which is %d\n",empty_room_count,room_id);
-	prompt_c();
 }
 
+// all room status changes go through here to keep the bitmaps and counts in sync,
+// only the holder of a room (its reservation or its patient) may set its status
+void room_set_status(unsigned int room_index, enum RoomStatus status){
+	enum RoomStatus old_status = __atomic_exchange_n(room_status_at(room_index),(unsigned char)status,__ATOMIC_ACQ_REL);
+	if ((old_status == VACANT) != (status == VACANT))
+		room_vacancy_changed(room_index,status == VACANT);
+	if ((old_status == FULL) != (status == FULL) && room_ward_slots[room_index] != UINT_MAX){
+		unsigned int ward_index = room_ward_slots[room_index]/ROOM_WARD_SPAN;
+		__atomic_fetch_add(&ward_counters[ward_index%WARD_COUNTER_STRIPES].occupied_rooms,status == FULL ? 1 : -1,__ATOMIC_RELAXED);
+	}
+}
 
-//------------------------------------------------------------------------------------------------------
-// Patient Operations
-
+unsigned int vacant_room_total(){
+	unsigned int total = 0;
+	for (int i=0; i<WARD_COUNTER_STRIPES; i++) total += __atomic_load_n(&ward_counters[i].vacant_rooms,__ATOMIC_RELAXED);
+	return total;
+}
 
-unsigned char patient_selection_loop(unsigned int *patient_id, unsigned char *patient_index){
-	while (0 == 0){
-		title("patient selection menu");
-		puts("Please enter Patient ID:");
-		*patient_id = prompt_d();
+unsigned int occupied_room_total(){
+	unsigned int total = 0;
+	for (int i=0; i<WARD_COUNTER_STRIPES; i++) total += __atomic_load_n(&ward_counters[i].occupied_rooms,__ATOMIC_RELAXED);
+	return total;
+}
 
-		// cancel if not found
-		*patient_index = patient_index_from_id(*patient_id);
-		if (*patient_index == UCHAR_MAX) break;
+// Room Reservations
+// A room is claimed by a single compare-and-swap of its status from VACANT to RESERVED,
+// so of any number of threads trying to take the same room exactly one succeeds, without
+// a lock. The holder then either fills it (RESERVED to FULL) or releases it.
 
-		display_patient_data(*patient_index);
-		puts("Is this the correct patient? (y)");
-		if (prompt_y() == 0) continue;
+// defined prototype before declaration
+void view_change_begin();
+void view_change_end();
+void view_mark(struct Table *table, unsigned int index);
 
-		return 1;
+// returns 1 if the room was vacant and is now reserved for the caller
+char room_reserve(unsigned int room_index){
+	unsigned char expected = VACANT;
+	view_change_begin();
+	char reserved = __atomic_compare_exchange_n(room_status_at(room_index),&expected,RESERVED,0,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED);
+	if (reserved){
+		room_vacancy_changed(room_index,0);
+		view_mark(&rooms,room_index);
 	}
-	return 0;
+	view_change_end();
+	return reserved;
 }
 
-void view_patient(){
-	int patient_id;
-	unsigned char patient_index;
-	char success;
+// give back a reservation that wasn't used
+void room_release(unsigned int room_index){
+	view_change_begin();
+	room_set_status(room_index,VACANT);
+	view_mark(&rooms,room_index);
+	view_change_end();
+}
 
-	// find patient
-	while (success == 0){
-		success = patient_selection_loop(&patient_id,&patient_index);
-		puts("There is no patient with this ID, enter new ID? (y)");
-		if (prompt_y()==0) return;
+// returns the first vacant room of a ward numbered at or after number, UINT_MAX if none
+unsigned int ward_vacant_room_after(unsigned int ward_index, unsigned int number){
+	struct Ward *ward = &wards[ward_index];
+	for (unsigned int word_index=number/VACANCY_WORD_BITS; word_index<WARD_VACANCY_WORDS; word_index++){
+		unsigned long long word = __atomic_load_n(&ward->vacancy_bits[word_index],__ATOMIC_ACQUIRE);
+		// mask off the rooms before the starting point in the first word
+		if (word_index == number/VACANCY_WORD_BITS) word &= ~0ULL << (number%VACANCY_WORD_BITS);
+		if (word != 0) return ward->room_indexes[word_index*VACANCY_WORD_BITS + __builtin_ctzll(word)];
 	}
-	
+	return UINT_MAX;
 }
 
-char register_patient(unsigned int patient_id,unsigned char *patient_index){
-	if (patient_count==MAX_PATIENT_COUNT){
-		puts("Maximum number of patients was reached");
-		return 0;
-	} 
-	struct Patient patient = {.id = patient_id, .status=DISMISSED};
-	char success = 0;
-	puts("");
-	puts("Leave any field empty to exit");
-	puts("Please enter new patient's name:");
-	
-	while (0==0){
-		char last_name[50];
-		puts(S_SEPARATOR);
-		puts("First Name:");
-		prompt_s(patient.name);
-
-		if (strlen(patient.name)==0) return 0;//allow exit on empty prompt
-		if (validate_string(
-			patient.name,
-			VALID_PATIENT_MIN_LEN,
-			VALID_PATIENT_MAX_LEN,
-			VALID_PATIENT_CHARS,
-			VALID_PATIENT_NUM_ALLOWED,
-			VALID_PATIENT_MESSAGE)==0) continue;
-
-		puts("Last Name:");
-		prompt_s(last_name);
-
-		if (strlen(patient.name)==0) return 0;//allow exit on empty prompt
-		if (validate_string(
-			last_name,
-			VALID_PATIENT_MIN_LEN,
-			VALID_PATIENT_MAX_LEN,
-			VALID_PATIENT_CHARS,
-			VALID_PATIENT_NUM_ALLOWED,
-			VALID_PATIENT_MESSAGE)==0) continue;
-		
-		strcat(patient.name," ");
-		strcat(patient.name,last_name);
-
-		printf("is patient name: [%s] acceptable? (y)\n",patient.name);
-		if (prompt_y()==1){
-			break;
-		}
+// returns the first ward at or after ward_index with a vacant room, UINT_MAX if none
+unsigned int ward_with_vacancy_after(unsigned int ward_index){
+	if (ward_index >= ward_count) return UINT_MAX;
+	unsigned int word_count = (ward_count+VACANCY_WORD_BITS-1)/VACANCY_WORD_BITS;
+	unsigned int word_index = ward_index/VACANCY_WORD_BITS;
+	unsigned long long word = __atomic_load_n(&ward_vacancy_bits[word_index],__ATOMIC_ACQUIRE) & (~0ULL << (ward_index%VACANCY_WORD_BITS));
+	while (word == 0){
+		word_index++;
+		if (word_index >= word_count) return UINT_MAX;
+		word = __atomic_load_n(&ward_vacancy_bits[word_index],__ATOMIC_ACQUIRE);
 	}
-	memcpy(&patients[patient_count],&patient,sizeof(patient));
-	// increment patient count to add patient
-	patient_count++;
-	printf("Patient %s successfully created with id : %d\n",patient.name,patient.id);
-	puts("");
-	puts("Warning!:");
-	puts("Patient Status can only be updated after admission to hospital");
-	puts("To admit patient to hospital use transfer patient");
-	return 1;
+	return word_index*VACANCY_WORD_BITS + __builtin_ctzll(word);
 }
 
-char transfer_patient(unsigned char passed_patient_index){
-	int patient_id;
-	unsigned char patient_room_index;
-	unsigned char patient_index;
-	unsigned char new_room_id;
-	unsigned char new_room_index;
-	char is_admission = 0, success;
-	// Retreive patient
-	if (passed_patient_index==UCHAR_MAX){
-		// find patient
-		success = patient_selection_loop(&patient_id,&patient_index);
-		if (success == 0) return 0;
-		patient_room_index = patient_room_index_from_id(patient_id);
+unsigned int first_vacant_room(){
+	unsigned int ward_index = ward_with_vacancy_after(0);
+	while (ward_index != UINT_MAX){
+		unsigned int room_index = ward_vacant_room_after(ward_index,0);
+		if (room_index != UINT_MAX) return room_index;
+		ward_index = ward_with_vacancy_after(ward_index+1);
 	}
-	else{
-		// set to passed value
-		success = 1;
-		patient_index = passed_patient_index;
-		patient_id = patients[patient_index].id;
+	return UINT_MAX;
+}
+
+// reserves the first vacant room of a ward, UINT_MAX if the ward is full
+// the bitmap can be a step behind the status words, so losing a race just moves on to the next room
+unsigned int ward_reserve_vacant(unsigned int ward_index){
+	unsigned int room_index = ward_vacant_room_after(ward_index,0);
+	while (room_index != UINT_MAX && room_reserve(room_index) == 0){
+		room_index = ward_vacant_room_after(ward_index,room_ward_slots[room_index]%ROOM_WARD_SPAN+1);
 	}
-	
-	// Allow admission of patient to hospital
-	if (patient_room_index == UCHAR_MAX && is_admission == 0){
-		puts(S_SEPARATOR);
-		puts("Patient not currently in any room, admit patient to hospital? (y)");
-		if (prompt_y()==1) is_admission = 1;
-		else{
-			puts(S_CANCELLED);
-			return 0;
-		}
-		
+	return room_index;
+}
+
+// reserves a vacant room in the given ward, or in the next ward with one when it is full,
+// wrapping around to the wards before it, UINT_MAX if no room is left
+unsigned int room_reserve_vacant(unsigned int ward_index){
+	if (ward_count == 0) return UINT_MAX;
+	if (ward_index >= ward_count) ward_index = 0;
+	unsigned int room_index = ward_reserve_vacant(ward_index);
+	unsigned int next = ward_with_vacancy_after(ward_index+1);
+	while (room_index == UINT_MAX && next != UINT_MAX){
+		room_index = ward_reserve_vacant(next);
+		next = ward_with_vacancy_after(next+1);
 	}
-	
-	while (0==0){
-		find_vacant_room(&new_room_id,&new_room_index);
-		
-		// Confirm operation
-		printf("Transfer patient %s to room %d ? (y)\n",
-			patients[patient_index].name,new_room_id);
-		if (prompt_y()==1){
-			
-			rooms[new_room_index].patient_id = patient_id;
-			rooms[new_room_index].status = FULL;
-			printf("patient %s successfully transfered to room %d\n",
-			patients[patient_index].name,new_room_id);
-
-			if (!is_admission){
-				rooms[patient_room_index].patient_id = 0;
-				rooms[patient_room_index].status = VACANT;
-			}
-			else{
-				patients[patient_index].status = VISIT;
-				puts("Remember to update patient status");
-			}
-			
-			return 1;
-		}
-		puts("cancel operation? (y)");
-		if (prompt_y()==1){
-			puts(S_CANCELLED);
-			break;
-		}
-		
+	next = ward_with_vacancy_after(0);
+	while (room_index == UINT_MAX && next != UINT_MAX && next < ward_index){
+		room_index = ward_reserve_vacant(next);
+		next = ward_with_vacancy_after(next+1);
 	}
+	return room_index;
 }
 
-void update_patient(){
-	unsigned int patient_id;
-	unsigned char patient_room_index;
-	unsigned char patient_index;
-
-	while (0==0){
-		char success = patient_selection_loop(&patient_id,&patient_index);
+unsigned int room_index_from_id(unsigned int id){
+	unsigned int ward_index = ward_index_from_id(id/ROOM_WARD_SPAN);
+	if (ward_index == UINT_MAX) return UINT_MAX;
+	return wards[ward_index].room_indexes[id%ROOM_WARD_SPAN];
+}
 
-		if (success == 0){
-			puts("Patient not registered, register a new patient? (y)");
-			if (prompt_y()==1){
-				success = register_patient(patient_id,&patient_index);
-				if (success==0){
-					puts(S_CANCELLED);
-					return;
-				}
-				puts("Would you lik to admit patient? (y)");
-				if (prompt_y()==1){
-					if (transfer_patient(patient_id)) break;
-					return;
-				}
-			}
-			else{
-				puts(S_CANCELLED);
-				return;
-			}
-		}
-		
-		patient_room_index = patient_room_index_from_id(patient_id);
-		
-		// Allow re-entry of patient id
-		if (patient_room_index == UCHAR_MAX){
-			puts(S_SEPARATOR);
-			puts("Patient not currently in any room, return? (y)");
-			if (prompt_y()==0)continue;
-			return;
-		}
-		break;
-	}
+// defined prototype before declaration
+unsigned int patient_index_from_id(unsigned int patient_id);
 
-	puts(S_SEPARATOR);
-	puts("Enter New Status:");
-	puts("(V) Visit\n(R) Recover\n(I) Ill\n(S) Severe\nOther to cancel");
-	puts("");
-	
-	// convert char to enum
-	const char* options = "vris";
-	char *chr = strchr(options,tolower(prompt_c()));
-	if (chr != NULL){
-		patients[patient_index].status = (int)(chr-options);
-		printf("patient status updated to %s\n",PatientStatusToS[patients[patient_index].status]);
-		return;
-	}
-	puts(S_CANCELLED);
+// uses the patient's reverse link instead of searching the rooms
+unsigned int patient_room_index_from_id(unsigned int patient_id){
+	unsigned int patient_index = patient_index_from_id(patient_id);
+	if (patient_index == UINT_MAX) return UINT_MAX;
+	return *patient_room_index_at(patient_index);
 }
 
-void discharge_patient(){
-	int patient_id;
-	unsigned char patient_room_index;
-	unsigned char patient_index;
-	// Uses find patient in room function to retreive patient
-	while (0==0){
-		char success = patient_selection_loop(&patient_id,&patient_index);
+// Column Scans
+// whole-table counts read a single column a slab at a time, each slab a plain byte array,
+// and compare against one value per pass so the compiler turns the loop into vector compares
+unsigned int count_bytes_equal(unsigned char *bytes, unsigned int length, unsigned char value){
+	unsigned int count = 0;
+	// a length that is a whole number of vectors lets the main loop vectorize at -O2
+	unsigned int whole = length & ~63u;
+	for (unsigned int i=0; i<whole; i++) count += bytes[i] == value;
+	for (unsigned int i=whole; i<length; i++) count += bytes[i] == value;
+	return count;
+}
 
-		if (success == 0) return;
-		
-		patient_room_index = patient_room_index_from_id(patient_id);
-		
-		// Allow re-entry of patient id
-		if (patient_room_index == UCHAR_MAX){
-			puts(S_SEPARATOR);
-			puts("Patient not currently in any room, enter new id? (y)");
-			if (prompt_y()==0)continue;
-			puts(S_CANCELLED);
-			return;
+void patient_status_counts(unsigned int counts[DISMISSED+1]){
+	memset(counts,0,sizeof(unsigned int)*(DISMISSED+1));
+	for (unsigned int slab=0; slab<patients.slab_count; slab++){
+		unsigned char *statuses = patients.slabs[PATIENT_STATUS][slab];
+		unsigned int used = table_slab_used(&patients,slab);
+		for (int status=VISIT; status<=DISMISSED; status++){
+			counts[status] += count_bytes_equal(statuses,used,status);
 		}
-		break;
 	}
-	
-	// Clear the room's patient data
-	rooms[patient_room_index].status = VACANT;
-	rooms[patient_room_index].patient_id = 0;// not necessary but somewhat nice
+}
 
-	//change patient status
-	patients[patient_index].status = DISMISSED; // special value for later use
+unsigned int occupied_room_count(){
+	unsigned int count = 0;
+	for (unsigned int slab=0; slab<rooms.slab_count; slab++){
+		count += count_bytes_equal(rooms.slabs[ROOM_STATUS][slab],table_slab_used(&rooms,slab),FULL);
+	}
+	return count;
+}
 
-	// Confirm operation success
-	puts(S_SEPARATOR);
-	printf("Patient %s has been successfully discharged from room %d\n",patients[patient_index].name,patient_room_index);
-	prompt_c();
+// recount the census after the tables were filled in bulk, starting the admission
+// and discharge counts over
+void census_rebuild(){
+	patient_status_counts(census.patients_by_status);
+	census.admissions = 0;
+	census.discharges = 0;
 }
 
-//------------------------------------------------------------------------------------------------------
-// User Operations
+// Patient ID Hash Index
+// open addressing with linear probing, each slot keeps the id next to the index
+// so a lookup doesn't need to touch the patient records until it finds a match
+#define PATIENT_ID_INDEX_MIN_CAPACITY 64
 
+struct PatientIdSlot {
+	unsigned int id;
+	unsigned int index; // UINT_MAX marks an empty slot
+};
 
-void register_user(){
-	if (user_count==MAX_USER_COUNT){
-		puts("Maximum number of users was reached");
-		return;
-	} 
-	struct User user;
-	char pass[STRING_MAX_LEN];
-	char success = 0;
-	puts("");
-	puts("Leave any field empty to exit");
-	puts("Please enter new user's data:");
+struct PatientIdSlot *patient_id_index = NULL;
+unsigned int patient_id_index_capacity = 0; // always a power of two
+unsigned int patient_id_index_used = 0;
 
-	// Username Loop
-	while (0==0){
-		puts(S_SEPARATOR);
-		puts("Username:");
-		prompt_s(user.name);
-
-		if (strlen(user.name)==0) return;//allow exit on empty prompt
-		if (validate_string(
-			user.name,
-			VALID_USERNAME_MIN_LEN,
-			VALID_USERNAME_MAX_LEN,
-			VALID_USERNAME_CHARS,
-			VALID_USERNAME_NUM_ALLOWED,
-			VALID_USERNAME_MESSAGE)==0) continue;
+unsigned int hash_id(unsigned int id){
+	// integer mixer to spread sequential ids over the whole table
+	id ^= id >> 16;
+	id *= 0x85ebca6bu;
+	id ^= id >> 13;
+	id *= 0xc2b2ae35u;
+	id ^= id >> 16;
+	return id;
+}
 
-		//if name is already found ask for a new name
-		if (user_index_from_name(user.name)!=UINT_MAX){
-			puts("User name already in use");
-			continue;
-		}
+// returns the slot holding the id, or the empty slot where it should be placed
+struct PatientIdSlot* patient_id_index_probe(struct PatientIdSlot *slots, unsigned int capacity, unsigned int patient_id){
+	unsigned int mask = capacity-1;
+	unsigned int slot = hash_id(patient_id) & mask;
+	while (slots[slot].index != UINT_MAX && slots[slot].id != patient_id){
+		slot = (slot+1) & mask;
+	}
+	return &slots[slot];
+}
 
-		printf("is username: [%s] acceptable? (y)\n",user.name);
-		if (prompt_y()==1){
-			break;
-		}
+char patient_id_index_resize(unsigned int capacity){
+	struct PatientIdSlot *slots = malloc(sizeof(struct PatientIdSlot)*capacity);
+	if (slots == NULL) return 0;
+	memset(slots,0xFF,sizeof(struct PatientIdSlot)*capacity); // every slot starts empty
+
+	// re-insert all used slots into the new table
+	for (unsigned int i=0; i<patient_id_index_capacity; i++){
+		if (patient_id_index[i].index == UINT_MAX) continue;
+		*patient_id_index_probe(slots,capacity,patient_id_index[i].id) = patient_id_index[i];
 	}
+	free(patient_id_index);
+	patient_id_index = slots;
+	patient_id_index_capacity = capacity;
+	return 1;
+}
 
-	// Password Loop
-	while (0==0){
-		puts(S_SEPARATOR);
-		puts("Password:");
-		prompt_s(user.password);
-
-		if (strlen(user.password)==0) return; //allow exit on empty prompt
-		if (validate_string(
-			user.password,
-			VALID_PASSWORD_MIN_LEN,
-			VALID_PASSWORD_MAX_LEN,
-			VALID_PASSWORD_CHARS,
-			VALID_PASSWORD_NUM_ALLOWED,
-			VALID_PASSWORD_MESSAGE) == 0) continue; 
-
-		puts("Re-enter Password:");
-		prompt_s(pass);
+char patient_id_index_grow(){
+	unsigned int capacity = patient_id_index_capacity*2;
+	if (capacity < PATIENT_ID_INDEX_MIN_CAPACITY) capacity = PATIENT_ID_INDEX_MIN_CAPACITY;
+	return patient_id_index_resize(capacity);
+}
 
-		if (strlen(pass)==0) return; //allow exit on empty prompt
-		if (strcmp(pass,user.password)!=0){
-			puts("Password is incorrect");
-			continue;
+char patient_id_index_insert(unsigned int patient_id, unsigned int patient_index){
+	// keep the load factor under 1/2 so probe sequences stay short
+	if ((patient_id_index_used+1)*2 > patient_id_index_capacity){
+		if (patient_id_index_grow()==0){
+			out_s("Failed to allocate memory for the patient index");
+			return 0;
 		}
-		break;
 	}
-	
-	//privelage loop
-	success = 0;
-	while (success==0){
-		puts(S_SEPARATOR);
-		puts("Privelage Level:");
-		puts("(A) Admin");
-		puts("(S) Staff");
-		puts("");
+	struct PatientIdSlot *slot = patient_id_index_probe(patient_id_index,patient_id_index_capacity,patient_id);
+	if (slot->index == UINT_MAX) patient_id_index_used++;
+	slot->id = patient_id;
+	slot->index = patient_index;
+	return 1;
+}
 
-		switch (tolower(prompt_c()))
-		{
-		case 'a':
-			// warn user in case they choose to make an admin
-			// should probably re-check for current admin's password
-			// to avoid security risk of impersonation nand backdoor creation
-			puts("Warning!!!: an admin would have the same privelage as yourself");
-			puts("Are you sure you want to do this? (y)");
-			if (prompt_y()==1){
-				user.privilege=ADMIN;
-				memcpy(&users[user_count],&user,sizeof(user));
-				success = 1;
-			}
-			break;
-		
-		case 's':
-			user.privilege=STAFF;
-			memcpy(&users[user_count],&user,sizeof(user));
-			success = 1;
-			break;
-		
-		default:
-			break;
-		}
+// make room for count ids at once instead of doubling repeatedly
+char patient_id_index_reserve(unsigned int count){
+	unsigned int capacity = PATIENT_ID_INDEX_MIN_CAPACITY;
+	while (capacity < count*2) capacity *= 2;
+	if (capacity <= patient_id_index_capacity) return 1;
+	if (patient_id_index_resize(capacity)==0){
+		out_s("Failed to allocate memory for the patient index");
+		return 0;
 	}
+	return 1;
+}
 
-	// increment user count to add user
-	user_count++;
-	printf("User %s successfully created with %s privileges\n",user.name,PrivsToS[user.privilege]);
+// rebuild the id index after the patients table was filled in bulk
+char patient_id_index_rebuild(){
+	free(patient_id_index);
+	patient_id_index = NULL;
+	patient_id_index_capacity = 0;
+	patient_id_index_used = 0;
+	if (patient_id_index_reserve(patients.count)==0) return 0;
+	for (unsigned int i=0; i<patients.count; i++){
+		if (patient_id_index_insert(*patient_id_at(i),i)==0) return 0;
+	}
+	return 1;
+}
 
+unsigned int patient_index_from_id(unsigned int patient_id){
+	if (patient_id_index_used == 0) return UINT_MAX;
+	return patient_id_index_probe(patient_id_index,patient_id_index_capacity,patient_id)->index;
 }
 
+// User Directory
+// the same open addressing as the patient ids, keyed by the hash of the username,
+// the name itself is only compared once the hashes match
+// the number of users of each privilege is kept alongside it
+#define USER_DIRECTORY_MIN_CAPACITY 64
 
-//------------------------------------------------------------------------------------------------------
-// Menu Loops
+struct UserNameSlot {
+	unsigned int hash;
+	unsigned int index; // UINT_MAX marks an empty slot
+};
 
+struct UserNameSlot *user_directory = NULL;
+unsigned int user_directory_capacity = 0; // always a power of two
+unsigned int user_directory_used = 0;
+unsigned int user_privilege_counts[4]; // indexed by enum Privs
 
-// session loop allows taking multiple actions wthin the same session
-void session_loop(struct User user){
-	char exit = 0;
-	char action;
-	while (exit == 0){
-		title("main menu");
-		puts("What would you like to do?");
-		if (user.privilege == ADMIN)
-			puts("(U) Register New User");
-		puts("(C) Check Empty Rooms");
-		if (user.privilege == ADMIN || user.privilege == STAFF){
-			puts("(V) View Patient");
-			puts("(S) Update Patient Status (or register patient)");
-			puts("(T) Transfer Patient (or admit patient)");
-			puts("(D) Discharge Patient");
-		}
-		puts("(E) Exit (Logout)");
-		puts("");
+unsigned int hash_name(char *name){
+	// fnv-1a over the name, mixed so the low bits used for the slot depend on every character
+	unsigned int hash = 2166136261u;
+	while (*name){
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash_id(hash);
+}
 
-		switch (tolower(prompt_c()))
-		{
+// returns the slot holding the name, or the empty slot where it should be placed
+struct UserNameSlot* user_directory_probe(struct UserNameSlot *slots, unsigned int capacity, char *name, unsigned int hash){
+	unsigned int mask = capacity-1;
+	unsigned int slot = hash & mask;
+	while (slots[slot].index != UINT_MAX
+		&& (slots[slot].hash != hash || strcmp(string_at(user_at(slots[slot].index)->name),name) != 0)){
+		slot = (slot+1) & mask;
+	}
+	return &slots[slot];
+}
+
+char user_directory_resize(unsigned int capacity){
+	struct UserNameSlot *slots = malloc(sizeof(struct UserNameSlot)*capacity);
+	if (slots == NULL) return 0;
+	memset(slots,0xFF,sizeof(struct UserNameSlot)*capacity); // every slot starts empty
+
+	// re-insert all used slots into the new table, names are already unique
+	for (unsigned int i=0; i<user_directory_capacity; i++){
+		if (user_directory[i].index == UINT_MAX) continue;
+		unsigned int slot = user_directory[i].hash & (capacity-1);
+		while (slots[slot].index != UINT_MAX) slot = (slot+1) & (capacity-1);
+		slots[slot] = user_directory[i];
+	}
+	free(user_directory);
+	user_directory = slots;
+	user_directory_capacity = capacity;
+	return 1;
+}
+
+// index a user that was just added to the users table
+char user_directory_add(unsigned int user_index){
+	struct User *user = user_at(user_index);
+	// keep the load factor under 1/2 so probe sequences stay short
+	if ((user_directory_used+1)*2 > user_directory_capacity){
+		unsigned int capacity = user_directory_capacity*2;
+		if (capacity < USER_DIRECTORY_MIN_CAPACITY) capacity = USER_DIRECTORY_MIN_CAPACITY;
+		if (user_directory_resize(capacity)==0){
+			out_s("Failed to allocate memory for the user directory");
+			return 0;
+		}
+	}
+	char *name = string_at(user->name);
+	unsigned int hash = hash_name(name);
+	struct UserNameSlot *slot = user_directory_probe(user_directory,user_directory_capacity,name,hash);
+	if (slot->index == UINT_MAX) user_directory_used++;
+	slot->hash = hash;
+	slot->index = user_index;
+	if (user->privilege <= GUEST) user_privilege_counts[user->privilege]++;
+	return 1;
+}
+
+// rebuild the directory and counts after the users table was filled in bulk
+char user_directory_rebuild(){
+	free(user_directory);
+	user_directory = NULL;
+	user_directory_capacity = 0;
+	user_directory_used = 0;
+	memset(user_privilege_counts,0,sizeof(user_privilege_counts));
+	unsigned int capacity = USER_DIRECTORY_MIN_CAPACITY;
+	while (capacity < users.count*2) capacity *= 2;
+	if (user_directory_resize(capacity)==0){
+		out_s("Failed to allocate memory for the user directory");
+		return 0;
+	}
+	for (unsigned int i=0; i<users.count; i++){
+		if (user_directory_add(i)==0) return 0;
+	}
+	return 1;
+}
+
+unsigned int user_index_from_name(char *name){
+	if (user_directory_used == 0) return UINT_MAX;
+	return user_directory_probe(user_directory,user_directory_capacity,name,hash_name(name))->index;
+}
+
+// returns the index of the user matching both name and password, UINT_MAX otherwise
+unsigned int user_index_from_login(char *name, char *password){
+	static struct User unknown_user; // checked against for unknown names, so they take as long as a wrong password
+	unsigned int user_index = user_index_from_name(name);
+	struct User *user = user_index == UINT_MAX ? &unknown_user : user_at(user_index);
+	// only login if both name and password are correct
+	if (user_check_password(user,password) == 0) return UINT_MAX;
+	return user_index;
+}
+
+char admin_available(){
+	return user_privilege_counts[ADMIN] > 0;
+}
+
+// Patient Name Index
+// a trie over the lowercased words of every patient name, first and last names alike,
+// each node lists the patients having exactly that word and counts the words ending below it
+// nodes and postings live in two growing arrays and refer to each other by index
+// searches walk the trie with the most selective word of the query: prefix matches are the
+// subtree under that word, typos are found by carrying an edit distance row down the trie
+// and pruning branches already too far off, every candidate is then checked against the
+// whole query so results are ranked by their total distance
+// postings are never removed, candidates are always checked against the name they have now
+#define NAME_INDEX_MIN_CAPACITY 1024
+#define NAME_SEARCH_MAX_WORDS 4
+#define NAME_SEARCH_MAX_RESULTS 9
+
+struct NameNode {
+	unsigned int first_child; // UINT_MAX when there is none
+	unsigned int next_sibling;
+	unsigned int postings; // first patient with exactly this word, UINT_MAX when there is none
+	unsigned int subtree_count; // words ending at or below this node
+	char letter;
+};
+
+struct NamePosting {
+	unsigned int patient_index;
+	unsigned int next;
+};
+
+struct {
+	struct NameNode *nodes; // node 0 is the root
+	unsigned int node_count;
+	unsigned int node_capacity;
+	struct NamePosting *postings;
+	unsigned int posting_count;
+	unsigned int posting_capacity;
+} name_index;
+
+struct NameMatch {
+	unsigned int patient_index;
+	unsigned int distance;
+};
+
+// make room for one more element in a growing array
+char name_index_reserve(void **array, unsigned int *capacity, unsigned int count, size_t element_size){
+	if (count < *capacity) return 1;
+	unsigned int new_capacity = *capacity < NAME_INDEX_MIN_CAPACITY ? NAME_INDEX_MIN_CAPACITY : *capacity*2;
+	void *new_array = realloc(*array,element_size*new_capacity);
+	if (new_array == NULL) return 0;
+	*array = new_array;
+	*capacity = new_capacity;
+	return 1;
+}
+
+unsigned int name_node_child(unsigned int node, char letter){
+	unsigned int child = name_index.nodes[node].first_child;
+	while (child != UINT_MAX && name_index.nodes[child].letter != letter) child = name_index.nodes[child].next_sibling;
+	return child;
+}
+
+// returns UINT_MAX when memory runs out
+unsigned int name_node_add_child(unsigned int node, char letter){
+	unsigned int child = name_node_child(node,letter);
+	if (child != UINT_MAX) return child;
+	if (name_index_reserve((void**)&name_index.nodes,&name_index.node_capacity,name_index.node_count,sizeof(struct NameNode))==0) return UINT_MAX;
+	child = name_index.node_count++;
+	name_index.nodes[child] = (struct NameNode){UINT_MAX,name_index.nodes[node].first_child,UINT_MAX,0,letter};
+	name_index.nodes[node].first_child = child;
+	return child;
+}
+
+void name_index_clear(){
+	name_index.node_count = 0;
+	name_index.posting_count = 0;
+}
+
+// index every word of a patient's name
+char name_index_add(unsigned int patient_index){
+	if (name_index.node_count == 0){
+		if (name_index_reserve((void**)&name_index.nodes,&name_index.node_capacity,0,sizeof(struct NameNode))==0) goto fail;
+		name_index.nodes[0] = (struct NameNode){UINT_MAX,UINT_MAX,UINT_MAX,0,0};
+		name_index.node_count = 1;
+	}
+	char *name = patient_name_at(patient_index);
+	while (*name != 0){
+		if (*name == ' '){
+			name++;
+			continue;
+		}
+		char *word = name;
+		unsigned int node = 0;
+		for (; *name != 0 && *name != ' '; name++){
+			node = name_node_add_child(node,tolower((unsigned char)*name));
+			if (node == UINT_MAX) goto fail;
+		}
+		if (name_index_reserve((void**)&name_index.postings,&name_index.posting_capacity,name_index.posting_count,sizeof(struct NamePosting))==0) goto fail;
+		unsigned int posting = name_index.posting_count++;
+		name_index.postings[posting] = (struct NamePosting){patient_index,name_index.nodes[node].postings};
+		name_index.nodes[node].postings = posting;
+
+		// count the word on its whole path
+		node = 0;
+		name_index.nodes[0].subtree_count++;
+		for (; word != name; word++){
+			node = name_node_child(node,tolower((unsigned char)*word));
+			name_index.nodes[node].subtree_count++;
+		}
+	}
+	return 1;
+fail:
+	out_s("Failed to allocate memory for the name index");
+	return 0;
+}
+
+char name_index_rebuild(){
+	name_index_clear();
+	for (unsigned int i=0; i<patients.count; i++){
+		if (name_index_add(i)==0) return 0;
+	}
+	return 1;
+}
+
+// typos allowed in a query word, short words have to match exactly
+unsigned int name_word_max_distance(unsigned int length){
+	if (length < 4) return 0;
+	if (length < 8) return 1;
+	return 2;
+}
+
+// edit distance between a query word and the closest prefix of a name word,
+// counting swapped neighbouring letters as a single edit
+unsigned int name_word_distance(char *query, unsigned int query_length, char *word, unsigned int word_length){
+	unsigned char d[STRING_MAX_LEN+1][STRING_MAX_LEN+1];
+	for (unsigned int i=0; i<=query_length; i++) d[i][0] = i;
+	for (unsigned int j=0; j<=word_length; j++) d[0][j] = j;
+	for (unsigned int i=1; i<=query_length; i++){
+		for (unsigned int j=1; j<=word_length; j++){
+			unsigned char best = d[i-1][j-1] + (query[i-1] != word[j-1]);
+			if (d[i-1][j]+1 < best) best = d[i-1][j]+1;
+			if (d[i][j-1]+1 < best) best = d[i][j-1]+1;
+			if (i>1 && j>1 && query[i-1]==word[j-2] && query[i-2]==word[j-1] && d[i-2][j-2]+1 < best) best = d[i-2][j-2]+1;
+			d[i][j] = best;
+		}
+	}
+	unsigned int best = UINT_MAX;
+	for (unsigned int j=0; j<=word_length; j++){
+		if (d[query_length][j] < best) best = d[query_length][j];
+	}
+	return best;
+}
+
+struct NameSearch {
+	char words[NAME_SEARCH_MAX_WORDS][STRING_MAX_LEN];
+	unsigned int lengths[NAME_SEARCH_MAX_WORDS];
+	unsigned int word_count;
+	unsigned int key; // the word walked through the trie
+	unsigned int pass; // key distance looked for in this pass
+	char count_only; // only add up the names that would be collected
+	unsigned int candidate_count;
+	struct NameMatch *matches;
+	unsigned int match_count;
+	unsigned int max_matches;
+};
+
+// the total distance of a patient's name to the query, UINT_MAX when a word doesn't match
+unsigned int name_search_distance(struct NameSearch *search, unsigned int patient_index){
+	char name[STRING_MAX_LEN];
+	unsigned int name_length = 0;
+	for (char *c = patient_name_at(patient_index); *c != 0; c++) name[name_length++] = tolower((unsigned char)*c);
+
+	unsigned int total = 0;
+	for (unsigned int w=0; w<search->word_count; w++){
+		unsigned int best = UINT_MAX;
+		for (unsigned int start=0; start<name_length; start++){
+			if (name[start] == ' ' || (start>0 && name[start-1] != ' ')) continue;
+			unsigned int end = start;
+			while (end < name_length && name[end] != ' ') end++;
+			unsigned int distance = name_word_distance(search->words[w],search->lengths[w],name+start,end-start);
+			if (distance < best) best = distance;
+		}
+		if (best > name_word_max_distance(search->lengths[w])) return UINT_MAX;
+		total += best;
+	}
+	return total;
+}
+
+// returns 0 once the results can no longer improve
+char name_search_offer(struct NameSearch *search, unsigned int patient_index){
+	for (unsigned int i=0; i<search->match_count; i++){
+		if (search->matches[i].patient_index == patient_index) return 1;
+	}
+	unsigned int distance = name_search_distance(search,patient_index);
+	if (distance == UINT_MAX) return 1;
+
+	// insert in order of distance, after the matches found earlier with the same distance
+	unsigned int i = search->match_count;
+	if (i == search->max_matches){
+		if (distance >= search->matches[i-1].distance) return search->matches[i-1].distance > search->pass;
+		i--;
+	}
+	else search->match_count++;
+	for (; i>0 && search->matches[i-1].distance > distance; i--) search->matches[i] = search->matches[i-1];
+	search->matches[i] = (struct NameMatch){patient_index,distance};
+	return search->match_count < search->max_matches || search->matches[search->match_count-1].distance > search->pass;
+}
+
+char name_search_postings(struct NameSearch *search, unsigned int node){
+	for (unsigned int p = name_index.nodes[node].postings; p != UINT_MAX; p = name_index.postings[p].next){
+		if (name_search_offer(search,name_index.postings[p].patient_index)==0) return 0;
+	}
+	return 1;
+}
+
+char name_search_subtree(struct NameSearch *search, unsigned int node){
+	for (unsigned int child = name_index.nodes[node].first_child; child != UINT_MAX; child = name_index.nodes[child].next_sibling){
+		if (name_search_postings(search,child)==0) return 0;
+		if (name_search_subtree(search,child)==0) return 0;
+	}
+	return 1;
+}
+
+// walk the trie keeping the distance row of the key against the letters so far,
+// collect the subtrees where the whole key matches with exactly the distance of this pass
+char name_search_fuzzy(struct NameSearch *search, unsigned int node, unsigned char *row, unsigned char *previous_row, char letter, unsigned int depth){
+	char *key = search->words[search->key];
+	unsigned int length = search->lengths[search->key];
+	for (unsigned int child = name_index.nodes[node].first_child; child != UINT_MAX; child = name_index.nodes[child].next_sibling){
+		char child_letter = name_index.nodes[child].letter;
+		unsigned char child_row[STRING_MAX_LEN+1];
+		unsigned char lowest = child_row[0] = depth+1;
+		for (unsigned int i=1; i<=length; i++){
+			unsigned char best = row[i-1] + (key[i-1] != child_letter);
+			if (row[i]+1 < best) best = row[i]+1;
+			if (child_row[i-1]+1 < best) best = child_row[i-1]+1;
+			if (previous_row != NULL && i>1 && key[i-1]==letter && key[i-2]==child_letter && previous_row[i-2]+1 < best) best = previous_row[i-2]+1;
+			child_row[i] = best;
+			if (best < lowest) lowest = best;
+		}
+		// below a smaller distance everything was collected by an earlier pass
+		if (child_row[length] < search->pass) continue;
+		if (child_row[length] == search->pass){
+			if (search->count_only){
+				search->candidate_count += name_index.nodes[child].subtree_count;
+				continue;
+			}
+			if (name_search_postings(search,child)==0) return 0;
+			if (name_search_subtree(search,child)==0) return 0;
+			continue;
+		}
+		if (lowest > search->pass) continue;
+		if (name_search_fuzzy(search,child,child_row,row,child_letter,depth+1)==0) return 0;
+	}
+	return 1;
+}
+
+// returns the number of patients found, best matches first
+unsigned int name_search(char *query, struct NameMatch *matches, unsigned int max_matches){
+	struct NameSearch search = {.word_count = 0, .count_only = 0, .matches = matches, .match_count = 0, .max_matches = max_matches};
+	if (name_index.node_count == 0 || max_matches == 0) return 0;
+
+	// split the query into lowercase words
+	while (*query != 0 && search.word_count < NAME_SEARCH_MAX_WORDS){
+		if (isspace((unsigned char)*query)){
+			query++;
+			continue;
+		}
+		unsigned int length = 0;
+		for (; *query != 0 && !isspace((unsigned char)*query); query++){
+			if (length < STRING_MAX_LEN-1) search.words[search.word_count][length++] = tolower((unsigned char)*query);
+		}
+		search.lengths[search.word_count++] = length;
+	}
+	if (search.word_count == 0) return 0;
+
+	// the key is the word bringing up the fewest candidates: the names under its prefix,
+	// or for a word no name starts with, the names within one typo of it
+	unsigned char root_row[STRING_MAX_LEN+1];
+	for (unsigned int i=0; i<=STRING_MAX_LEN; i++) root_row[i] = i;
+	unsigned int key = 0;
+	unsigned int key_node = UINT_MAX;
+	unsigned int key_count = UINT_MAX;
+	for (unsigned int w=0; w<search.word_count; w++){
+		unsigned int node = 0;
+		for (unsigned int i=0; i<search.lengths[w] && node != UINT_MAX; i++) node = name_node_child(node,search.words[w][i]);
+		unsigned int count;
+		if (node != UINT_MAX) count = name_index.nodes[node].subtree_count;
+		else if (name_word_max_distance(search.lengths[w]) == 0) return 0; // no name can match this word
+		else{
+			search.key = w;
+			search.pass = 1;
+			search.count_only = 1;
+			search.candidate_count = 0;
+			name_search_fuzzy(&search,0,root_row,NULL,0,0);
+			search.count_only = 0;
+			count = search.candidate_count;
+		}
+		if (count < key_count){
+			key = w;
+			key_node = node;
+			key_count = count;
+		}
+	}
+	search.key = key;
+
+	// exact prefix first, with the names having exactly that word ahead of the longer ones
+	search.pass = 0;
+	if (key_node != UINT_MAX){
+		if (name_search_postings(&search,key_node)==0 || name_search_subtree(&search,key_node)==0) return search.match_count;
+	}
+
+	unsigned int max_distance = name_word_max_distance(search.lengths[search.key]);
+	for (search.pass=1; search.pass<=max_distance; search.pass++){
+		// a second typo is only looked for when nothing closer turned up
+		if (search.pass > 1 && search.match_count > 0) break;
+		if (name_search_fuzzy(&search,0,root_row,NULL,0,0)==0) break;
+	}
+	return search.match_count;
+}
+
+//------------------------------------------------------------------------------------------------------
+// Read Views
+
+
+// A read view is a frozen copy of everything that changes in rooms and patients: room
+// status and occupant, patient status and room, plus the census and vacancy counts.
+// Readers pin the current view and read it without locks while changes go on. Names,
+// ids and room ids never change once written, so views leave those in the tables.
+// A view copies only the slabs written since the view before it. Every change marks
+// the slabs it writes, and all other slabs are shared between the two views.
+// The marked slabs are copied while changes go on, reading each record atomically, and
+// a slab changed during the copy is marked again and copied once more, for a few rounds.
+// Only the last few slabs are copied with changes held off, for a consistent cut: a new
+// view waits until no change is in flight and holds off new ones while it copies at most
+// READ_VIEW_MAX_PAUSED_SLABS slabs of each table. When changes keep more slabs than that
+// marked, the previous view is kept for now rather than holding them off for longer.
+// When no more than that are marked to begin with, they are all copied in the pause.
+// Each change only registers itself with an atomic count.
+// Retired views are freed by epoch: each reading thread publishes the epoch it pinned
+// at, and a view retired at an earlier epoch than every pinned one has no readers left.
+#define READ_VIEW_MAX_THREADS 64
+#define READ_VIEW_COPY_ROUNDS 4 // copies of the marked slabs while changes go on
+#define READ_VIEW_MAX_PAUSED_SLABS 8 // slabs of a table copied while changes wait
+
+enum ViewColumn {VIEW_ROOM_STATUS,VIEW_ROOM_PATIENT_ID,VIEW_PATIENT_STATUS,VIEW_PATIENT_ROOM_INDEX,VIEW_COLUMN_COUNT};
+
+struct {
+	struct Table *table;
+	unsigned int column;
+} VIEW_SOURCES[VIEW_COLUMN_COUNT] = {
+	{&rooms,ROOM_STATUS},{&rooms,ROOM_PATIENT_ID},{&patients,PATIENT_STATUS},{&patients,PATIENT_ROOM_INDEX},
+};
+
+struct ViewSlab {
+	unsigned int references; // views sharing it, only changed while building
+	unsigned char data[];
+};
+
+struct ReadView {
+	unsigned long long version; // changes made before it was built
+	unsigned long long retired_epoch;
+	unsigned int room_count;
+	unsigned int patient_count;
+	unsigned int slab_counts[VIEW_COLUMN_COUNT];
+	struct ViewSlab **slabs[VIEW_COLUMN_COUNT];
+	unsigned int patients_by_status[DISMISSED+1];
+	unsigned int occupied_rooms;
+	unsigned int vacant_rooms;
+	unsigned int first_vacant_room; // UINT_MAX when there is none
+	unsigned long long admissions;
+	unsigned long long discharges;
+	struct ReadView *next_retired;
+};
+
+struct {
+	struct ReadView *current; // NULL until the first reader
+	unsigned long long changes; // changes made so far
+	unsigned int changing; // changes in flight
+	char building; // set while a view is copied, changes wait for it
+	unsigned long long epoch; // starts at 1, 0 in a reader slot means not reading
+	unsigned long long reader_epochs[READ_VIEW_MAX_THREADS];
+	unsigned int reader_count;
+	pthread_mutex_t build_mutex; // one builder at a time, also guards the retired list
+	struct ReadView *retired;
+} views = {.epoch = 1, .build_mutex = PTHREAD_MUTEX_INITIALIZER};
+
+__thread int view_reader_slot = -1;
+
+// every change to the room or patient tables happens between these two, never nested
+void view_change_begin(){
+	while (0==0){
+		__atomic_fetch_add(&views.changing,1,__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&views.building,__ATOMIC_SEQ_CST) == 0) return;
+		// a view is being copied, step back until it is done
+		__atomic_fetch_sub(&views.changing,1,__ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&views.building,__ATOMIC_ACQUIRE)) sched_yield();
+	}
+}
+
+void view_change_end(){
+	__atomic_fetch_add(&views.changes,1,__ATOMIC_RELAXED);
+	__atomic_fetch_sub(&views.changing,1,__ATOMIC_RELEASE);
+}
+
+// marks the slab holding a record as written since the last view, after the record is
+// written, so a builder that takes the mark sees the write
+void view_mark(struct Table *table, unsigned int index){
+	__atomic_store_n(&table->view_dirty[index>>TABLE_SLAB_SHIFT],1,__ATOMIC_RELEASE);
+}
+
+void* view_at(struct ReadView *view, enum ViewColumn column, unsigned int index){
+	return view->slabs[column][index>>TABLE_SLAB_SHIFT]->data
+		+ (size_t)(index&(TABLE_SLAB_RECORDS-1))*VIEW_SOURCES[column].table->column_sizes[VIEW_SOURCES[column].column];
+}
+
+unsigned char view_room_status(struct ReadView *view, unsigned int room_index){
+	return *(unsigned char*)view_at(view,VIEW_ROOM_STATUS,room_index);
+}
+
+unsigned int view_room_patient_id(struct ReadView *view, unsigned int room_index){
+	return *(unsigned int*)view_at(view,VIEW_ROOM_PATIENT_ID,room_index);
+}
+
+unsigned char view_patient_status(struct ReadView *view, unsigned int patient_index){
+	return *(unsigned char*)view_at(view,VIEW_PATIENT_STATUS,patient_index);
+}
+
+unsigned int view_patient_room_index(struct ReadView *view, unsigned int patient_index){
+	return *(unsigned int*)view_at(view,VIEW_PATIENT_ROOM_INDEX,patient_index);
+}
+
+void read_view_free(struct ReadView *view){
+	for (int column=0; column<VIEW_COLUMN_COUNT; column++){
+		for (unsigned int i=0; i<view->slab_counts[column]; i++){
+			if (view->slabs[column][i] != NULL && --view->slabs[column][i]->references == 0) free(view->slabs[column][i]);
+		}
+		free(view->slabs[column]);
+	}
+	free(view);
+}
+
+// frees the retired views no reader can still hold, called while building
+void read_view_reclaim(){
+	unsigned long long oldest = ULLONG_MAX;
+	unsigned int reader_count = __atomic_load_n(&views.reader_count,__ATOMIC_SEQ_CST);
+	for (unsigned int i=0; i<reader_count && i<READ_VIEW_MAX_THREADS; i++){
+		unsigned long long epoch = __atomic_load_n(&views.reader_epochs[i],__ATOMIC_SEQ_CST);
+		if (epoch != 0 && epoch < oldest) oldest = epoch;
+	}
+	struct ReadView **link = &views.retired;
+	while (*link != NULL){
+		struct ReadView *view = *link;
+		if (view->retired_epoch < oldest){
+			*link = view->next_retired;
+			read_view_free(view);
+		}
+		else link = &view->next_retired;
+	}
+}
+
+// takes the slabs marked since the last time and clears their marks in one step, so a mark
+// made meanwhile is either taken here or kept for the next time. Adds them to taken and
+// returns how many there were
+unsigned int read_view_take_marks(struct Table *table, unsigned char *dirty, unsigned char *taken){
+	unsigned int slab_count = (table->count+TABLE_SLAB_RECORDS-1)>>TABLE_SLAB_SHIFT, marked = 0;
+	for (unsigned int i=0; i<slab_count; i++){
+		dirty[i] = __atomic_exchange_n(&table->view_dirty[i],0,__ATOMIC_ACQ_REL);
+		taken[i] |= dirty[i];
+		marked += dirty[i];
+	}
+	return marked;
+}
+
+// puts back the marks taken for a view that wasn't built
+void read_view_restore_marks(struct Table *table, unsigned char *taken){
+	unsigned int slab_count = (table->count+TABLE_SLAB_RECORDS-1)>>TABLE_SLAB_SHIFT;
+	for (unsigned int i=0; i<slab_count; i++){
+		if (taken[i]) __atomic_store_n(&table->view_dirty[i],1,__ATOMIC_RELAXED);
+	}
+}
+
+// copies one slab of a column into the view, over the view's own copy from an earlier round
+// when it has one. While changes go on every record is read atomically, as changes write them
+char read_view_copy_slab(struct ReadView *view, enum ViewColumn column, unsigned int i, char paused){
+	struct Table *table = VIEW_SOURCES[column].table;
+	unsigned int record_size = table->column_sizes[VIEW_SOURCES[column].column];
+	struct ViewSlab *slab = view->slabs[column][i];
+	// a slab shared with the previous view is left to it
+	if (slab == NULL || slab->references > 1){
+		struct ViewSlab *copy = malloc(sizeof(struct ViewSlab)+(size_t)record_size*TABLE_SLAB_RECORDS);
+		if (copy == NULL) return 0;
+		if (slab != NULL) slab->references--;
+		copy->references = 1;
+		view->slabs[column][i] = slab = copy;
+	}
+	void *source = table->slabs[VIEW_SOURCES[column].column][i];
+	unsigned int used = table_slab_used(table,i);
+	if (paused) memcpy(slab->data,source,(size_t)record_size*used);
+	else if (record_size == sizeof(unsigned int)){
+		for (unsigned int j=0; j<used; j++) ((unsigned int*)slab->data)[j] = __atomic_load_n((unsigned int*)source+j,__ATOMIC_RELAXED);
+	}
+	else{
+		for (unsigned int j=0; j<used; j++) slab->data[j] = __atomic_load_n((unsigned char*)source+j,__ATOMIC_RELAXED);
+	}
+	return 1;
+}
+
+// copies the marked slabs of every column, returns 0 if memory ran out
+char read_view_copy_marked(struct ReadView *view, unsigned char *room_dirty, unsigned char *patient_dirty, char paused){
+	for (int column=0; column<VIEW_COLUMN_COUNT; column++){
+		unsigned char *dirty = VIEW_SOURCES[column].table == &rooms ? room_dirty : patient_dirty;
+		for (unsigned int i=0; i<view->slab_counts[column]; i++){
+			if (dirty[i] && read_view_copy_slab(view,column,i,paused)==0) return 0;
+		}
+	}
+	return 1;
+}
+
+// publishes a view of the tables as they are now, returns 0 if memory ran out. The
+// previous view stays current when changes keep too many slabs marked to copy them while
+// holding changes off. Rooms and patients are only added with every change held off by
+// the caller, so the tables don't grow while a view is built
+char read_view_build(){
+	// only used under the build mutex
+	static unsigned char room_dirty[TABLE_MAX_SLABS], patient_dirty[TABLE_MAX_SLABS];
+	static unsigned char room_taken[TABLE_MAX_SLABS], patient_taken[TABLE_MAX_SLABS];
+	struct ReadView *previous = views.current;
+	struct ReadView *view = calloc(1,sizeof(struct ReadView));
+	if (view == NULL) return 0;
+	view->room_count = rooms.count;
+	view->patient_count = patients.count;
+	memset(room_taken,0,sizeof(room_taken));
+	memset(patient_taken,0,sizeof(patient_taken));
+
+	// slabs the previous view doesn't have are copied like marked ones
+	unsigned int room_marked = read_view_take_marks(&rooms,room_dirty,room_taken);
+	unsigned int patient_marked = read_view_take_marks(&patients,patient_dirty,patient_taken);
+	for (unsigned int i=previous == NULL ? 0 : previous->room_count>>TABLE_SLAB_SHIFT; i<(rooms.count+TABLE_SLAB_RECORDS-1)>>TABLE_SLAB_SHIFT; i++){
+		room_marked += room_dirty[i] == 0;
+		room_dirty[i] = room_taken[i] = 1;
+	}
+	for (unsigned int i=previous == NULL ? 0 : previous->patient_count>>TABLE_SLAB_SHIFT; i<(patients.count+TABLE_SLAB_RECORDS-1)>>TABLE_SLAB_SHIFT; i++){
+		patient_marked += patient_dirty[i] == 0;
+		patient_dirty[i] = patient_taken[i] = 1;
+	}
+	// few enough to copy with changes held off, as it mostly is, then nothing is copied before
+	char copy_first = room_marked > READ_VIEW_MAX_PAUSED_SLABS || patient_marked > READ_VIEW_MAX_PAUSED_SLABS;
+
+	// share every unmarked slab with the previous view and copy the others as changes go on
+	char copied = 1;
+	for (int column=0; column<VIEW_COLUMN_COUNT && copied; column++){
+		struct Table *table = VIEW_SOURCES[column].table;
+		unsigned char *dirty = table == &rooms ? room_dirty : patient_dirty;
+		unsigned int slab_count = (table->count+TABLE_SLAB_RECORDS-1)>>TABLE_SLAB_SHIFT;
+		view->slabs[column] = calloc(slab_count+1,sizeof(struct ViewSlab*));
+		if (view->slabs[column] == NULL){
+			copied = 0;
+			break;
+		}
+		view->slab_counts[column] = slab_count;
+		for (unsigned int i=0; i<slab_count; i++){
+			if (dirty[i] == 0){
+				view->slabs[column][i] = previous->slabs[column][i];
+				view->slabs[column][i]->references++;
+			}
+			else if (copy_first && read_view_copy_slab(view,column,i,0)==0){
+				copied = 0;
+				break;
+			}
+		}
+	}
+
+	// copy again what changed meanwhile, until few enough slabs are left to copy with changes held off
+	for (int round=0; round<READ_VIEW_COPY_ROUNDS && copied && copy_first; round++){
+		room_marked = read_view_take_marks(&rooms,room_dirty,room_taken);
+		patient_marked = read_view_take_marks(&patients,patient_dirty,patient_taken);
+		copied = read_view_copy_marked(view,room_dirty,patient_dirty,0);
+		if (room_marked <= READ_VIEW_MAX_PAUSED_SLABS && patient_marked <= READ_VIEW_MAX_PAUSED_SLABS) break;
+	}
+	// the very first view has nothing to fall back on
+	if (copied && previous != NULL && (room_marked > READ_VIEW_MAX_PAUSED_SLABS || patient_marked > READ_VIEW_MAX_PAUSED_SLABS)){
+		read_view_restore_marks(&rooms,room_taken);
+		read_view_restore_marks(&patients,patient_taken);
+		read_view_free(view);
+		return 1;
+	}
+
+	if (copied){
+		// hold off new changes, wait for the ones in flight and copy the slabs they marked
+		__atomic_store_n(&views.building,1,__ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&views.changing,__ATOMIC_SEQ_CST) != 0) sched_yield();
+		view->version = __atomic_load_n(&views.changes,__ATOMIC_RELAXED);
+		read_view_take_marks(&rooms,room_dirty,room_taken);
+		read_view_take_marks(&patients,patient_dirty,patient_taken);
+		// without the rounds before, the slabs marked at the start are still to be copied too
+		if (copy_first) copied = read_view_copy_marked(view,room_dirty,patient_dirty,1);
+		else copied = read_view_copy_marked(view,room_taken,patient_taken,1);
+		if (copied){
+			memcpy(view->patients_by_status,census.patients_by_status,sizeof(census.patients_by_status));
+			view->occupied_rooms = occupied_room_total();
+			view->vacant_rooms = vacant_room_total();
+			view->first_vacant_room = first_vacant_room();
+			view->admissions = census.admissions;
+			view->discharges = census.discharges;
+		}
+		__atomic_store_n(&views.building,0,__ATOMIC_RELEASE);
+	}
+	if (copied == 0){
+		read_view_restore_marks(&rooms,room_taken);
+		read_view_restore_marks(&patients,patient_taken);
+		read_view_free(view);
+		return 0;
+	}
+
+	// readers pinning from the next epoch on see the new view, the old one waits for the rest
+	__atomic_store_n(&views.current,view,__ATOMIC_SEQ_CST);
+	if (previous != NULL){
+		previous->retired_epoch = __atomic_load_n(&views.epoch,__ATOMIC_SEQ_CST);
+		previous->next_retired = views.retired;
+		views.retired = previous;
+	}
+	__atomic_fetch_add(&views.epoch,1,__ATOMIC_SEQ_CST);
+	read_view_reclaim();
+	return 1;
+}
+
+// 1 when the view has every change made so far
+char read_view_is_current(struct ReadView *view){
+	return view != NULL && view->version == __atomic_load_n(&views.changes,__ATOMIC_RELAXED)
+		&& view->room_count == rooms.count && view->patient_count == patients.count;
+}
+
+// publishes this thread's epoch and loads the current view, which can't be freed from then on
+struct ReadView* read_view_load_pinned(){
+	__atomic_store_n(&views.reader_epochs[view_reader_slot],__atomic_load_n(&views.epoch,__ATOMIC_SEQ_CST),__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&views.current,__ATOMIC_SEQ_CST);
+}
+
+// returns a consistent view of rooms and patients, to be given back with read_view_unpin,
+// NULL if memory ran out or too many threads are reading
+struct ReadView* read_view_pin(){
+	if (view_reader_slot < 0){
+		unsigned int slot = __atomic_fetch_add(&views.reader_count,1,__ATOMIC_SEQ_CST);
+		if (slot >= READ_VIEW_MAX_THREADS) return NULL;
+		view_reader_slot = slot;
+	}
+
+	// pinned before the view is looked at, a builder can retire it at any moment
+	struct ReadView *current = read_view_load_pinned();
+	if (read_view_is_current(current)) return current;
+
+	// build a new view when there were changes since the current one, the current view
+	// is only freed by a builder so it is safe to look at under the build mutex
+	pthread_mutex_lock(&views.build_mutex);
+	char built = 1;
+	if (read_view_is_current(views.current) == 0) built = read_view_build();
+	pthread_mutex_unlock(&views.build_mutex);
+	if (built == 0){
+		read_view_unpin();
+		return NULL;
+	}
+	return read_view_load_pinned();
+}
+
+void read_view_unpin(){
+	__atomic_store_n(&views.reader_epochs[view_reader_slot],0,__ATOMIC_RELEASE);
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Journal
+
+
+// Every change is appended to the journal as a small binary record before it is
+// considered saved. Records collect in a buffer and are written with a single
+// fdatasync once the buffer fills or the oldest record has waited long enough,
+// so one sync is shared by every operation in that group.
+// With several threads, whichever thread first needs its records on disk writes
+// out the whole group while the others keep filling the second buffer, then
+// every thread waiting on that group is woken.
+// Records store the resulting state (not the difference), so replaying a record
+// that already reached the data file is harmless.
+// Changes are made in the mapped data file before their record is durable, and the
+// kernel can write those pages back at any time, so after a crash the data file can also
+// be ahead of the journal, with part of a change whose record never got written. A
+// transfer writes a room and a patient in different slabs, so only one of them can have
+// reached the disk: on load every room and patient is checked to point at each other
+// and a change only half there is undone before the journal is replayed.
+// At a checkpoint the data file is synced and the journal emptied.
+// If a group can't be written or synced, its records and every later one are never
+// reported as saved: the journal stops taking records until the next start, and the
+// threads waiting on them are told the change was not saved.
+#define JOURNAL_BUFFER_SIZE 65536
+#define JOURNAL_COMMIT_INTERVAL_MS 50
+#define JOURNAL_HEADER_SIZE 6 // type, payload length, checksum
+
+enum JournalRecordType {JOURNAL_PATIENT_MOVE=1,JOURNAL_PATIENT_STATUS,JOURNAL_PATIENT_ADD,JOURNAL_USER_ADD};
+
+struct {
+	int fd;
+	char replaying; // set while replaying so changes aren't journaled twice
+	char committing; // a thread is writing out a group
+	char failed; // a group failed to reach the disk, nothing is journaled after it
+	int active; // buffer currently being filled
+	unsigned int used;
+	unsigned int pending_records;
+	long long first_pending_ms;
+	unsigned long long appended_sequence; // records appended so far
+	unsigned long long durable_sequence; // records known to be on disk
+	pthread_mutex_t mutex;
+	pthread_cond_t committed;
+	unsigned char buffers[2][JOURNAL_BUFFER_SIZE];
+} journal = {.fd = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .committed = PTHREAD_COND_INITIALIZER};
+
+unsigned int journal_checksum(unsigned char *data, unsigned int length){
+	// FNV-1a, enough to catch a torn write at the end of the journal
+	unsigned int hash = 2166136261u;
+	for (unsigned int i=0; i<length; i++){
+		hash = (hash^data[i])*16777619u;
+	}
+	return hash;
+}
+
+long long monotonic_ms(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (long long)now.tv_sec*1000 + now.tv_nsec/1000000;
+}
+
+// defined prototype before declaration
+void replication_ship(unsigned char *group, unsigned int length);
+void history_flush();
+
+char journal_write_group(unsigned char *group, unsigned int length){
+	unsigned int written = 0;
+	while (written < length){
+		ssize_t result = write(journal.fd,group+written,length-written);
+		if (result < 0 && errno == EINTR) continue;
+		if (result <= 0) return 0;
+		written += result;
+	}
+	return fdatasync(journal.fd) == 0;
+}
+
+// wait until the first sequence records are on disk, writing out the group if nobody else is,
+// returns 0 if they never will be
+char journal_wait_durable(unsigned long long sequence){
+	pthread_mutex_lock(&journal.mutex);
+	while (journal.durable_sequence < sequence && journal.failed == 0){
+		if (journal.committing){
+			pthread_cond_wait(&journal.committed,&journal.mutex);
+			continue;
+		}
+		// take the whole group, later records go to the other buffer meanwhile
+		journal.committing = 1;
+		unsigned char *group = journal.buffers[journal.active];
+		unsigned int length = journal.used;
+		unsigned long long group_sequence = journal.appended_sequence;
+		journal.active ^= 1;
+		journal.used = 0;
+		journal.pending_records = 0;
+		pthread_mutex_unlock(&journal.mutex);
+
+		char written = journal_write_group(group,length);
+		// groups are shipped in the order they reach the disk, one committer at a time
+		if (written){
+			replication_ship(group,length);
+			// the status changes saved in this group keep their history too
+			history_flush();
+		}
+		else out_s("Failed to write to the journal, changes are no longer saved");
+
+		pthread_mutex_lock(&journal.mutex);
+		if (written) journal.durable_sequence = group_sequence;
+		else journal.failed = 1;
+		journal.committing = 0;
+		pthread_cond_broadcast(&journal.committed);
+	}
+	char durable = journal.durable_sequence >= sequence;
+	pthread_mutex_unlock(&journal.mutex);
+	return durable;
+}
+
+// number of records appended so far, wait on it to know they are saved
+unsigned long long journal_sequence(){
+	pthread_mutex_lock(&journal.mutex);
+	unsigned long long sequence = journal.appended_sequence;
+	pthread_mutex_unlock(&journal.mutex);
+	return sequence;
+}
+
+// write out every buffered record and wait for it to reach the disk
+char journal_commit(){
+	return journal_wait_durable(journal_sequence());
+}
+
+// commit only once the oldest buffered record has waited long enough
+void journal_commit_if_due(){
+	pthread_mutex_lock(&journal.mutex);
+	char due = journal.pending_records > 0 && monotonic_ms()-journal.first_pending_ms >= JOURNAL_COMMIT_INTERVAL_MS;
+	pthread_mutex_unlock(&journal.mutex);
+	if (due) journal_commit();
+}
+
+void journal_append(enum JournalRecordType type, void *payload, unsigned char length){
+	if (journal.fd < 0 || journal.replaying) return;
+	pthread_mutex_lock(&journal.mutex);
+	// make space by writing out the full group
+	while (journal.used+JOURNAL_HEADER_SIZE+length > JOURNAL_BUFFER_SIZE && journal.failed == 0){
+		pthread_mutex_unlock(&journal.mutex);
+		journal_commit();
+		pthread_mutex_lock(&journal.mutex);
+	}
+	// still counted, so whoever waits on it learns it wasn't saved
+	if (journal.failed){
+		journal.appended_sequence++;
+		pthread_mutex_unlock(&journal.mutex);
+		return;
+	}
+	if (journal.pending_records == 0) journal.first_pending_ms = monotonic_ms();
+
+	unsigned char *record = journal.buffers[journal.active]+journal.used;
+	unsigned int checksum = journal_checksum(payload,length);
+	record[0] = type;
+	record[1] = length;
+	memcpy(record+2,&checksum,sizeof(checksum));
+	memcpy(record+JOURNAL_HEADER_SIZE,payload,length);
+	journal.used += JOURNAL_HEADER_SIZE+length;
+	journal.pending_records++;
+	journal.appended_sequence++;
+	pthread_mutex_unlock(&journal.mutex);
+}
+
+// Record payloads
+// names are stored with their terminator so they can be used straight from the buffer
+void journal_patient_move(unsigned int patient_id, unsigned int room_index){
+	unsigned int payload[2] = {patient_id,room_index};
+	journal_append(JOURNAL_PATIENT_MOVE,payload,sizeof(payload));
+}
+
+void journal_patient_status(unsigned int patient_id, enum PatientStatus status){
+	unsigned int payload[2] = {patient_id,status};
+	journal_append(JOURNAL_PATIENT_STATUS,payload,sizeof(payload));
+}
+
+void journal_patient_add(unsigned int patient_id, char *name){
+	unsigned char payload[sizeof(unsigned int)+STRING_MAX_LEN];
+	unsigned int name_length = strlen(name)+1;
+	memcpy(payload,&patient_id,sizeof(patient_id));
+	memcpy(payload+sizeof(patient_id),name,name_length);
+	journal_append(JOURNAL_PATIENT_ADD,payload,sizeof(patient_id)+name_length);
+}
+
+// only the salt and hash are journaled, never the password
+void journal_user_add(struct User *user){
+	unsigned char payload[1+STRING_MAX_LEN+USER_SALT_LEN+USER_HASH_LEN];
+	char *name = string_at(user->name);
+	unsigned int name_length = strlen(name)+1;
+	payload[0] = user->privilege;
+	memcpy(payload+1,name,name_length);
+	memcpy(payload+1+name_length,user->salt,USER_SALT_LEN);
+	memcpy(payload+1+name_length+USER_SALT_LEN,user->password_hash,USER_HASH_LEN);
+	journal_append(JOURNAL_USER_ADD,payload,1+name_length+USER_SALT_LEN+USER_HASH_LEN);
+}
+
+// defined prototype before declaration
+char patient_move(unsigned int patient_index, unsigned int room_index);
+void patient_set_status(unsigned int patient_index, enum PatientStatus status);
+unsigned int patient_add(unsigned int patient_id, char *name);
+
+// apply a single record, returns 0 if the record doesn't fit the current data
+char journal_apply(unsigned char type, unsigned char *payload, unsigned char length){
+	unsigned int values[2];
+	switch (type)
+	{
+	case JOURNAL_PATIENT_MOVE:
+	case JOURNAL_PATIENT_STATUS:
+		if (length != sizeof(values)) return 0;
+		memcpy(values,payload,sizeof(values));
+		unsigned int patient_index = patient_index_from_id(values[0]);
+		if (patient_index == UINT_MAX) return 0;
+		if (type == JOURNAL_PATIENT_STATUS){
+			if (values[1] > DISMISSED) return 0;
+			patient_set_status(patient_index,values[1]);
+			return 1;
+		}
+		if (values[1] == UINT_MAX) return patient_move(patient_index,UINT_MAX);
+		if (values[1] >= rooms.count) return 0;
+		if (*patient_room_index_at(patient_index) == values[1]) return 1;
+		// the data file can already hold a later state where someone else took the room,
+		// move them out, the later records in the journal will move them back in
+		if (*room_status_at(values[1]) == FULL){
+			unsigned int other_index = patient_index_from_id(*room_patient_id_at(values[1]));
+			if (other_index != UINT_MAX) patient_move(other_index,UINT_MAX);
+			else room_set_status(values[1],VACANT);
+		}
+		if (room_reserve(values[1])==0) return 0;
+		return patient_move(patient_index,values[1]);
+
+	case JOURNAL_PATIENT_ADD:
+		if (length <= sizeof(unsigned int) || payload[length-1] != 0) return 0;
+		memcpy(values,payload,sizeof(unsigned int));
+		// already added before the last checkpoint
+		if (patient_index_from_id(values[0]) != UINT_MAX) return 1;
+		return patient_add(values[0],(char*)payload+sizeof(unsigned int)) != UINT_MAX;
+
+	case JOURNAL_USER_ADD:{
+		struct User user = {.privilege = payload[0]};
+		char *name = (char*)payload+1;
+		if (length <= 1+USER_SALT_LEN+USER_HASH_LEN || payload[0] > GUEST) return 0;
+		// the name must end right where the salt and hash start
+		unsigned int name_length = length-1-USER_SALT_LEN-USER_HASH_LEN;
+		if (name_length > STRING_MAX_LEN || strnlen(name,name_length) != name_length-1) return 0;
+		if (user_index_from_name(name) != UINT_MAX) return 1;
+		if (string_append(name,&user.name)==0) return 0;
+		memcpy(user.salt,name+name_length,USER_SALT_LEN);
+		memcpy(user.password_hash,name+name_length+USER_SALT_LEN,USER_HASH_LEN);
+		return user_add(&user) != UINT_MAX;
+	}
+
+	default:
+		return 0;
+	}
+}
+
+// apply every complete record in the buffer, counting them in applied, returns the bytes
+// they took (a partial record at the end is left) or UINT_MAX at a damaged record
+unsigned int journal_apply_buffer(unsigned char *buffer, unsigned int length, unsigned int *applied){
+	unsigned int position = 0;
+	while (position+JOURNAL_HEADER_SIZE <= length){
+		unsigned char *record = buffer+position;
+		unsigned int checksum;
+		if (position+JOURNAL_HEADER_SIZE+record[1] > length) break;
+		memcpy(&checksum,record+2,sizeof(checksum));
+		if (checksum != journal_checksum(record+JOURNAL_HEADER_SIZE,record[1])
+			|| journal_apply(record[0],record+JOURNAL_HEADER_SIZE,record[1])==0) return UINT_MAX;
+		position += JOURNAL_HEADER_SIZE+record[1];
+		(*applied)++;
+	}
+	return position;
+}
+
+// undoes room changes that only partly reached the data file before a crash, returns the
+// number of rooms and patients put right. A full room is kept only when its patient points
+// back at it, then a patient pointing at a room that isn't kept by someone else gets it back
+unsigned int journal_repair_rooms(){
+	unsigned int repaired = 0;
+	for (unsigned int i=0; i<rooms.count; i++){
+		unsigned char *status = room_status_at(i);
+		if (*status != FULL) continue;
+		unsigned int patient_index = patient_index_from_id(*room_patient_id_at(i));
+		if (patient_index != UINT_MAX && *patient_room_index_at(patient_index) == i) continue;
+		*status = VACANT;
+		*room_patient_id_at(i) = 0;
+		repaired++;
+	}
+	for (unsigned int i=0; i<patients.count; i++){
+		unsigned int *room_index = patient_room_index_at(i);
+		if (*room_index == UINT_MAX) continue;
+		if (*room_index < rooms.count && *room_status_at(*room_index) == FULL && *room_patient_id_at(*room_index) == *patient_id_at(i)) continue;
+		if (*room_index >= rooms.count || *room_status_at(*room_index) == FULL) *room_index = UINT_MAX;
+		else{
+			*room_status_at(*room_index) = FULL;
+			*room_patient_id_at(*room_index) = *patient_id_at(i);
+		}
+		repaired++;
+	}
+	return repaired;
+}
+
+// replay every complete record in the journal, stopping at the first torn or damaged one
+unsigned int journal_replay(int fd){
+	static unsigned char buffer[JOURNAL_BUFFER_SIZE];
+	unsigned int buffered = 0;
+	unsigned int replayed = 0;
+	journal.replaying = 1;
+	while (0==0){
+		ssize_t result = read(fd,buffer+buffered,JOURNAL_BUFFER_SIZE-buffered);
+		if (result <= 0) break;
+		buffered += result;
+
+		// apply all complete records currently in the buffer
+		unsigned int position = journal_apply_buffer(buffer,buffered,&replayed);
+		if (position == UINT_MAX){
+			out_f("Journal record %u is damaged, ignoring the rest of the journal\n",replayed);
+			journal.replaying = 0;
+			return replayed;
+		}
+		// keep the partial record for the next read
+		memmove(buffer,buffer+position,buffered-position);
+		buffered -= position;
+	}
+	journal.replaying = 0;
+	return replayed;
+}
+
+// save the data file and empty the journal, everything in it is now in the data file
+void journal_checkpoint(){
+	if (journal.fd < 0) return;
+	journal_commit();
+	data_file_sync();
+	if (ftruncate(journal.fd,0) != 0) out_s("Failed to empty the journal");
+	lseek(journal.fd,0,SEEK_SET);
+}
+
+// open the journal, replaying what was left in it since the last checkpoint
+void journal_open(char *path, char replay){
+	journal.fd = open(path,O_RDWR|O_CREAT,0600);
+	if (journal.fd < 0){
+		out_s("Failed to open the journal, changes will not be journaled");
+		return;
+	}
+	if (replay){
+		unsigned int replayed = journal_replay(journal.fd);
+		if (replayed > 0 && output.quiet == 0) out_f("Recovered %u changes from the journal\n",replayed);
+	}
+	journal_checkpoint();
+}
+
+void journal_close(){
+	if (journal.fd < 0) return;
+	journal_checkpoint();
+	close(journal.fd);
+	journal.fd = -1;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Audit Log
+
+
+// Who registered, admitted, transferred, discharged or re-statused which patient, and who
+// registered which user, is kept in an audit file of fixed-size binary events.
+// Changes push their event onto a bounded lock-free ring (one sequence number per slot,
+// producers claim a slot with a compare and swap) and never wait: when the ring is full
+// the event is counted as dropped instead. A background thread drains the ring and
+// writes whatever it found with one write, starting a new file once the current one is
+// full and keeping the last few. Events that can't be written (the file can't be opened
+// again after rotating, or a write fails) are reported and counted as dropped. Changes replayed from the journal were audited when
+// they were first made, so the audit only starts once the data is loaded, and a standby
+// applying the primary's records leaves them to the primary's audit.
+#define AUDIT_RING_SIZE 16384 // a power of two
+#define AUDIT_FLUSH_INTERVAL_MS 10
+#define AUDIT_FILE_MAX_SIZE (16*1024*1024)
+#define AUDIT_FILE_COUNT 4 // the current file and the ones before it, as <path>.1, <path>.2 ...
+#define AUDIT_WRITE_EVENTS 256 // events written at once
+
+enum AuditEventType {AUDIT_REGISTER=1,AUDIT_ADMIT,AUDIT_TRANSFER,AUDIT_DISCHARGE,AUDIT_SET_STATUS,AUDIT_REGISTER_USER};
+char AuditEventTypeToS[AUDIT_REGISTER_USER+1][16] = {"","register","admit","transfer","discharge","set-status","register-user"};
+
+struct AuditEvent {
+	long long time_ms; // wall clock
+	unsigned int patient_id;
+	unsigned int room_id; // room moved into, UINT_MAX when none
+	unsigned char type; // enum AuditEventType
+	unsigned char status; // the patient's new status, or the new user's privilege
+	char actor[STRING_MAX_LEN]; // the user making the change
+	char subject[STRING_MAX_LEN]; // the new user's name
+	char reserved[10];
+};
+_Static_assert(sizeof(struct AuditEvent) == 128,"audit events are 128 bytes");
+
+struct AuditSlot {
+	unsigned long long sequence; // the position it can be written at, one more once written
+	struct AuditEvent event;
+};
+
+struct {
+	struct AuditSlot slots[AUDIT_RING_SIZE];
+	unsigned long long tail; // next position claimed by a producer
+	unsigned long long head; // next position drained, only touched by the flusher
+	unsigned long long dropped;
+	char running; // atomic, events are taken
+	char stopping; // atomic, tells the flusher to finish
+	char failing; // the last write failed, so it is only reported once
+	int fd;
+	char *path;
+	off_t size;
+	pthread_t thread;
+} audit = {.fd = -1};
+
+__thread char audit_actor[STRING_MAX_LEN]; // name of the user making changes on this thread
+
+// never blocks, returns 0 if the event had to be dropped
+char audit_push(struct AuditEvent *event){
+	if (__atomic_load_n(&audit.running,__ATOMIC_ACQUIRE) == 0) return 0;
+	unsigned long long position = __atomic_load_n(&audit.tail,__ATOMIC_RELAXED);
+	while (0==0){
+		struct AuditSlot *slot = &audit.slots[position & (AUDIT_RING_SIZE-1)];
+		long long difference = (long long)(__atomic_load_n(&slot->sequence,__ATOMIC_ACQUIRE) - position);
+		if (difference == 0){
+			if (__atomic_compare_exchange_n(&audit.tail,&position,position+1,1,__ATOMIC_RELAXED,__ATOMIC_RELAXED)){
+				slot->event = *event;
+				__atomic_store_n(&slot->sequence,position+1,__ATOMIC_RELEASE);
+				return 1;
+			}
+		}
+		else if (difference < 0){
+			// the flusher hasn't drained this slot since the last time around the ring
+			__atomic_fetch_add(&audit.dropped,1,__ATOMIC_RELAXED);
+			return 0;
+		}
+		else position = __atomic_load_n(&audit.tail,__ATOMIC_RELAXED);
+	}
+}
+
+void audit_record(enum AuditEventType type, unsigned int patient_id, unsigned int room_id, unsigned char status, char *subject){
+	struct AuditEvent event = {.patient_id = patient_id, .room_id = room_id, .type = type, .status = status};
+	if (__atomic_load_n(&audit.running,__ATOMIC_ACQUIRE) == 0 || journal.replaying) return;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	event.time_ms = (long long)now.tv_sec*1000 + now.tv_nsec/1000000;
+	strcpy(event.actor,audit_actor);
+	if (subject != NULL) strncpy(event.subject,subject,STRING_MAX_LEN-1);
+	audit_push(&event);
+}
+
+// moves <path> to <path>.1, <path>.1 to <path>.2 and so on, dropping the oldest
+void audit_rotate(){
+	char from[PATH_MAX], to[PATH_MAX];
+	fdatasync(audit.fd);
+	close(audit.fd);
+	for (int i=AUDIT_FILE_COUNT-1; i>0; i--){
+		if (i == 1) snprintf(from,sizeof(from),"%s",audit.path);
+		else snprintf(from,sizeof(from),"%s.%d",audit.path,i-1);
+		snprintf(to,sizeof(to),"%s.%d",audit.path,i);
+		rename(from,to);
+	}
+	audit.fd = open(audit.path,O_WRONLY|O_CREAT|O_APPEND,0600);
+	audit.size = 0;
+	if (audit.fd < 0) fprintf(stderr,"Failed to open a new audit file %s, audit events are dropped\n",audit.path);
+}
+
+// writes out everything in the ring, returns the number of events written
+unsigned int audit_drain(){
+	struct AuditEvent events[AUDIT_WRITE_EVENTS];
+	unsigned int total = 0;
+	while (0==0){
+		unsigned int count = 0;
+		while (count < AUDIT_WRITE_EVENTS){
+			struct AuditSlot *slot = &audit.slots[audit.head & (AUDIT_RING_SIZE-1)];
+			if (__atomic_load_n(&slot->sequence,__ATOMIC_ACQUIRE) != audit.head+1) break;
+			events[count++] = slot->event;
+			__atomic_store_n(&slot->sequence,audit.head+AUDIT_RING_SIZE,__ATOMIC_RELEASE);
+			audit.head++;
+		}
+		if (count == 0) return total;
+		if (audit.fd >= 0 && audit.size >= AUDIT_FILE_MAX_SIZE) audit_rotate();
+		// a file that couldn't be opened after rotating is tried again every time
+		if (audit.fd < 0){
+			audit.fd = open(audit.path,O_WRONLY|O_CREAT|O_APPEND,0600);
+			if (audit.fd >= 0) fprintf(stderr,"Audit file %s opened again\n",audit.path);
+		}
+		size_t size = sizeof(struct AuditEvent)*count;
+		if (audit.fd >= 0 && write(audit.fd,events,size) == (ssize_t)size){
+			audit.size += size;
+			audit.failing = 0;
+		}
+		else{
+			if (audit.fd >= 0 && audit.failing == 0) fprintf(stderr,"Failed to write to the audit file %s, audit events are dropped\n",audit.path);
+			audit.failing = 1;
+			__atomic_fetch_add(&audit.dropped,count,__ATOMIC_RELAXED);
+		}
+		total += count;
+	}
+}
+
+void* audit_flush_thread(void *argument){
+	(void)argument;
+	struct timespec interval = {0,AUDIT_FLUSH_INTERVAL_MS*1000000L};
+	while (__atomic_load_n(&audit.stopping,__ATOMIC_ACQUIRE) == 0){
+		if (audit_drain() == 0) nanosleep(&interval,NULL);
+	}
+	return NULL;
+}
+
+char audit_open(char *path){
+	audit.path = path;
+	audit.fd = open(path,O_WRONLY|O_CREAT|O_APPEND,0600);
+	if (audit.fd < 0) return 0;
+	struct stat file_stat;
+	audit.size = fstat(audit.fd,&file_stat) == 0 ? file_stat.st_size : 0;
+	for (unsigned int i=0; i<AUDIT_RING_SIZE; i++) audit.slots[i].sequence = i;
+	if (pthread_create(&audit.thread,NULL,audit_flush_thread,NULL) != 0){
+		close(audit.fd);
+		audit.fd = -1;
+		return 0;
+	}
+	__atomic_store_n(&audit.running,1,__ATOMIC_RELEASE);
+	return 1;
+}
+
+// writes out what is left and stops the flusher
+void audit_close(){
+	if (__atomic_load_n(&audit.running,__ATOMIC_ACQUIRE) == 0) return;
+	__atomic_store_n(&audit.running,0,__ATOMIC_RELEASE);
+	__atomic_store_n(&audit.stopping,1,__ATOMIC_RELEASE);
+	pthread_join(audit.thread,NULL);
+	audit_drain();
+	if (audit.dropped > 0) fprintf(stderr,"%llu audit events were dropped, the audit file couldn't keep up or be written\n",audit.dropped);
+	if (audit.fd < 0) return;
+	fdatasync(audit.fd);
+	close(audit.fd);
+	audit.fd = -1;
+}
+
+// prints an audit file as one line per event
+char audit_print(char *path){
+	struct AuditEvent event;
+	FILE *file = fopen(path,"rb");
+	if (file == NULL) return 0;
+	while (fread(&event,sizeof(event),1,file) == 1){
+		time_t seconds = event.time_ms/1000;
+		char time_text[32];
+		strftime(time_text,sizeof(time_text),"%Y-%m-%d %H:%M:%S",localtime(&seconds));
+		event.actor[STRING_MAX_LEN-1] = 0;
+		event.subject[STRING_MAX_LEN-1] = 0;
+		out_f("%s.%03lld %s %s",time_text,event.time_ms%1000,event.actor[0] != 0 ? event.actor : "-",
+			event.type <= AUDIT_REGISTER_USER ? AuditEventTypeToS[event.type] : "unknown");
+		if (event.type == AUDIT_REGISTER_USER) out_f(" %s %s\n",event.subject,event.status <= GUEST ? PrivsToS[event.status] : "");
+		else if (event.type == AUDIT_SET_STATUS) out_f(" %u %s\n",event.patient_id,event.status <= DISMISSED ? PatientStatusToS[event.status] : "");
+		else if (event.room_id != UINT_MAX) out_f(" %u room %u\n",event.patient_id,event.room_id);
+		else out_f(" %u\n",event.patient_id);
+	}
+	fclose(file);
+	return 1;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Status History
+
+
+// Every change of a patient's status is kept as an event (time, patient, old and new status,
+// room) in an append-only history, so the course of a stay can be looked up afterwards.
+// Events are stored by column in blocks of HISTORY_BLOCK_EVENTS: times as the difference
+// from the event before, patient and room ids as varints, both statuses in one byte, and
+// the distance back to the same patient's previous event, which chains a patient's events
+// together as the per-patient index. Each block keeps its time range and the statuses its
+// events move into, so a query skips every block that can't match without decoding it.
+// Events are stamped under the lock and never go back in time, so blocks are in time order.
+// New events collect in the open block as they are and are encoded once it fills, then
+// appended to the history file. Every time the journal commits a group, the open block is
+// written to a small file of its own, in turn to one of two slots so a torn write leaves
+// the other whole, and read back as the open block on the next start. A status change
+// that was saved keeps its history through a crash. Changes replayed from the journal on start are left out, like the audit, but
+// a standby keeps the history of the records it applies, so it carries on once promoted.
+// Full blocks are never changed again, queries read them without the lock once published.
+#define HISTORY_BLOCK_EVENTS 512
+#define HISTORY_BLOCK_SLAB_SHIFT 12 // blocks per slab of the block directory, as a power of two
+#define HISTORY_MAX_BLOCK_SLABS 512 // up to 2^30 events, so event numbers fit in 30 bits
+#define HISTORY_EVENT_MAX_BYTES 26 // a time difference, patient id, room id and distance back at most, and the statuses
+#define HISTORY_DISPLAY_EVENTS 10 // most recent events shown for a patient
+#define HISTORY_OPEN_SLOT_SIZE 16384 // bytes of each of the two slots in the open block file
+
+struct HistoryEvent {
+	long long time_ms; // wall clock
+	unsigned int patient_id;
+	unsigned int room_id; // the patient's room when it happened, UINT_MAX when none
+	unsigned int previous; // number of the patient's event before, UINT_MAX when none
+	unsigned char old_status;
+	unsigned char new_status;
+};
+
+struct HistoryBlockHeader {
+	long long first_time_ms;
+	long long last_time_ms;
+	unsigned int count;
+	unsigned int size; // bytes of encoded columns after the header
+	unsigned int patient_offset; // where each column starts, times start at 0
+	unsigned int room_offset;
+	unsigned int previous_offset;
+	unsigned int status_offset;
+	unsigned int checksum; // of the columns, a torn block at the end of the file is dropped
+	unsigned short new_statuses; // bit s set when an event moves into status s
+	unsigned short reserved;
+};
+
+struct HistoryBlock {
+	struct HistoryBlockHeader header;
+	unsigned char *columns;
+};
+
+// starts each slot of the open block file, the columns follow it
+struct HistoryOpenSlot {
+	unsigned int block_number; // the block it is the start of, stale once that block is full
+	unsigned int sequence; // the slot written last has the higher one
+	struct HistoryBlockHeader header; // count is 0 when no event was in the open block
+};
+_Static_assert(sizeof(struct HistoryOpenSlot)+HISTORY_BLOCK_EVENTS*HISTORY_EVENT_MAX_BYTES <= HISTORY_OPEN_SLOT_SIZE,"a full open block fits a slot");
+
+struct {
+	struct HistoryBlock *block_slabs[HISTORY_MAX_BLOCK_SLABS];
+	unsigned int sealed_count; // full blocks published, read without the lock
+	struct HistoryEvent open[HISTORY_BLOCK_EVENTS];
+	unsigned int open_count;
+	long long last_time_ms;
+	unsigned int *last_events; // by patient index, UINT_MAX when the patient has none
+	unsigned int last_events_capacity;
+	unsigned long long dropped;
+	char running;
+	int fd;
+	off_t file_size; // bytes of full blocks in the history file
+	unsigned int written_count; // full blocks in the history file, the rest are still to be written
+	char write_failing; // the last block couldn't be written, so it is only reported once
+	int open_fd;
+	unsigned int flushed_sealed; // sealed_count and open_count when the open block was last written
+	unsigned int flushed_count;
+	unsigned int open_sequence;
+	pthread_mutex_t mutex;
+	pthread_mutex_t flush_mutex; // one writer of the open block file at a time
+} history = {.fd = -1, .open_fd = -1, .mutex = PTHREAD_MUTEX_INITIALIZER, .flush_mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// LEB128, seven bits a byte lowest first, the top bit set on every byte but the last
+unsigned int varint_put(unsigned char *out, unsigned long long value){
+	unsigned int length = 0;
+	while (value >= 0x80){
+		out[length++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	out[length++] = value;
+	return length;
+}
+
+unsigned long long varint_get(unsigned char **in){
+	unsigned char *c = *in;
+	unsigned long long value = 0;
+	int shift = 0;
+	while (*c & 0x80){
+		value |= (unsigned long long)(*c++ & 0x7F) << shift;
+		shift += 7;
+	}
+	value |= (unsigned long long)*c++ << shift;
+	*in = c;
+	return value;
+}
+
+struct HistoryBlock* history_block_at(unsigned int block_number){
+	return &history.block_slabs[block_number >> HISTORY_BLOCK_SLAB_SHIFT][block_number & ((1u << HISTORY_BLOCK_SLAB_SHIFT)-1)];
+}
+
+// encodes count events, the first one numbered first_number, returns 0 when memory ran out
+char history_encode(struct HistoryEvent *events, unsigned int count, unsigned int first_number, struct HistoryBlock *block){
+	unsigned char *columns = malloc(count*HISTORY_EVENT_MAX_BYTES);
+	if (columns == NULL) return 0;
+	struct HistoryBlockHeader *header = &block->header;
+	*header = (struct HistoryBlockHeader){.first_time_ms = events[0].time_ms, .last_time_ms = events[count-1].time_ms, .count = count};
+	unsigned int size = 0;
+	for (unsigned int i=0; i<count; i++) size += varint_put(columns+size,events[i].time_ms-(i == 0 ? events[0].time_ms : events[i-1].time_ms));
+	header->patient_offset = size;
+	for (unsigned int i=0; i<count; i++) size += varint_put(columns+size,events[i].patient_id);
+	header->room_offset = size;
+	for (unsigned int i=0; i<count; i++) size += varint_put(columns+size,events[i].room_id == UINT_MAX ? 0 : (unsigned long long)events[i].room_id+1);
+	header->previous_offset = size;
+	for (unsigned int i=0; i<count; i++) size += varint_put(columns+size,events[i].previous == UINT_MAX ? 0 : first_number+i-events[i].previous);
+	header->status_offset = size;
+	for (unsigned int i=0; i<count; i++){
+		columns[size++] = events[i].old_status << 4 | events[i].new_status;
+		header->new_statuses |= 1 << events[i].new_status;
+	}
+	header->size = size;
+	header->checksum = journal_checksum(columns,size);
+	block->columns = realloc(columns,size);
+	if (block->columns == NULL) block->columns = columns;
+	return 1;
+}
+
+// decodes the first count events of a block numbered from first_number
+void history_decode(struct HistoryBlock *block, unsigned int first_number, struct HistoryEvent *events, unsigned int count){
+	unsigned char *times = block->columns;
+	unsigned char *patients = block->columns+block->header.patient_offset;
+	unsigned char *rooms = block->columns+block->header.room_offset;
+	unsigned char *previous = block->columns+block->header.previous_offset;
+	unsigned char *statuses = block->columns+block->header.status_offset;
+	long long time_ms = block->header.first_time_ms;
+	for (unsigned int i=0; i<count; i++){
+		time_ms += varint_get(&times);
+		events[i].time_ms = time_ms;
+		events[i].patient_id = varint_get(&patients);
+		events[i].room_id = varint_get(&rooms)-1; // 0, no room, wraps around to UINT_MAX
+		unsigned int distance = varint_get(&previous);
+		events[i].previous = distance == 0 ? UINT_MAX : first_number+i-distance;
+		events[i].old_status = statuses[i] >> 4;
+		events[i].new_status = statuses[i] & 0x0F;
+	}
+}
+
+// publishes a full block to the queries, returns 0 when the directory is full or memory ran out
+char history_publish(struct HistoryBlock *block){
+	unsigned int block_number = history.sealed_count;
+	unsigned int slab = block_number >> HISTORY_BLOCK_SLAB_SHIFT;
+	if (slab >= HISTORY_MAX_BLOCK_SLABS) return 0;
+	if (history.block_slabs[slab] == NULL){
+		history.block_slabs[slab] = malloc(sizeof(struct HistoryBlock) << HISTORY_BLOCK_SLAB_SHIFT);
+		if (history.block_slabs[slab] == NULL) return 0;
+	}
+	*history_block_at(block_number) = *block;
+	__atomic_store_n(&history.sealed_count,block_number+1,__ATOMIC_RELEASE);
+	return 1;
+}
+
+// appends a block to the history file, a block only partly written is cut off again so
+// the next one starts right after the last whole block
+char history_write_block(struct HistoryBlock *block){
+	if (history.fd < 0) return 1;
+	if (write(history.fd,&block->header,sizeof(block->header)) != sizeof(block->header)
+		|| write(history.fd,block->columns,block->header.size) != block->header.size){
+		if (ftruncate(history.fd,history.file_size) != 0 || lseek(history.fd,history.file_size,SEEK_SET) != history.file_size)
+			out_s("Failed to cut a torn block off the status history file");
+		return 0;
+	}
+	history.file_size += sizeof(block->header)+block->header.size;
+	return 1;
+}
+
+// writes the blocks sealed since the last time to the history file, under the flush mutex
+// and not the lock, so status changes go on meanwhile. Returns 0 if a block couldn't be
+// written, it is tried again the next time
+char history_write_sealed(){
+	unsigned int sealed_count = __atomic_load_n(&history.sealed_count,__ATOMIC_ACQUIRE);
+	while (history.written_count < sealed_count){
+		if (history_write_block(history_block_at(history.written_count))==0){
+			if (history.write_failing == 0) out_s("Failed to write to the status history file, it is tried again with the next block");
+			history.write_failing = 1;
+			return 0;
+		}
+		history.written_count++;
+		history.write_failing = 0;
+	}
+	return 1;
+}
+
+// encodes the open block once it is full, under the lock, it is written out after the lock
+// is let go
+void history_seal(){
+	struct HistoryBlock block;
+	if (history_encode(history.open,history.open_count,history.sealed_count*HISTORY_BLOCK_EVENTS,&block)==0
+		|| history_publish(&block)==0){
+		out_s("Failed to allocate memory for the status history, it is stopped");
+		history.running = 0;
+		return;
+	}
+	history.open_count = 0;
+}
+
+// makes sure the patient has a slot in the per-patient index, under the lock
+char history_reserve_patient(unsigned int patient_index){
+	if (patient_index < history.last_events_capacity) return 1;
+	unsigned int capacity = history.last_events_capacity == 0 ? 4096 : history.last_events_capacity;
+	while (capacity <= patient_index) capacity *= 2;
+	unsigned int *last_events = realloc(history.last_events,sizeof(unsigned int)*capacity);
+	if (last_events == NULL) return 0;
+	memset(last_events+history.last_events_capacity,0xFF,sizeof(unsigned int)*(capacity-history.last_events_capacity));
+	history.last_events = last_events;
+	history.last_events_capacity = capacity;
+	return 1;
+}
+
+// adds an event stamped with the later of its time and the last event's, returns 0 if it was dropped
+char history_add(unsigned int patient_index, struct HistoryEvent *event){
+	pthread_mutex_lock(&history.mutex);
+	unsigned int number = history.sealed_count*HISTORY_BLOCK_EVENTS+history.open_count;
+	if (history.running == 0 || number >= (unsigned int)HISTORY_MAX_BLOCK_SLABS*HISTORY_BLOCK_EVENTS << HISTORY_BLOCK_SLAB_SHIFT
+		|| history_reserve_patient(patient_index)==0){
+		history.dropped++;
+		pthread_mutex_unlock(&history.mutex);
+		return 0;
+	}
+	if (event->time_ms < history.last_time_ms) event->time_ms = history.last_time_ms;
+	history.last_time_ms = event->time_ms;
+	event->previous = history.last_events[patient_index];
+	history.last_events[patient_index] = number;
+	history.open[history.open_count++] = *event;
+	char sealed = history.open_count == HISTORY_BLOCK_EVENTS;
+	if (sealed) history_seal();
+	pthread_mutex_unlock(&history.mutex);
+	if (sealed){
+		pthread_mutex_lock(&history.flush_mutex);
+		history_write_sealed();
+		pthread_mutex_unlock(&history.flush_mutex);
+	}
+	return 1;
+}
+
+long long wall_clock_ms(){
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME,&now);
+	return (long long)now.tv_sec*1000 + now.tv_nsec/1000000;
+}
+
+void history_record(unsigned int patient_index, unsigned char old_status, unsigned char new_status, unsigned int room_id){
+	if (history.running == 0 || old_status == new_status) return;
+	struct HistoryEvent event = {.time_ms = wall_clock_ms(), .patient_id = *patient_id_at(patient_index),
+		.room_id = room_id, .old_status = old_status, .new_status = new_status};
+	history_add(patient_index,&event);
+}
+
+// the event numbered number, from the blocks published up to sealed_count
+void history_sealed_event(unsigned int number, struct HistoryEvent *event){
+	struct HistoryEvent events[HISTORY_BLOCK_EVENTS];
+	unsigned int position = number%HISTORY_BLOCK_EVENTS;
+	history_decode(history_block_at(number/HISTORY_BLOCK_EVENTS),number-position,events,position+1);
+	*event = events[position];
+}
+
+// up to max of the patient's events, newest first, returns how many there are
+unsigned int history_patient(unsigned int patient_index, struct HistoryEvent *events, unsigned int max){
+	unsigned int count = 0;
+	pthread_mutex_lock(&history.mutex);
+	unsigned int sealed_events = history.sealed_count*HISTORY_BLOCK_EVENTS;
+	unsigned int number = patient_index < history.last_events_capacity ? history.last_events[patient_index] : UINT_MAX;
+	// the events still in the open block can change once the lock is let go
+	while (number != UINT_MAX && number >= sealed_events && count < max){
+		events[count] = history.open[number-sealed_events];
+		number = events[count++].previous;
+	}
+	pthread_mutex_unlock(&history.mutex);
+	while (number != UINT_MAX && count < max){
+		history_sealed_event(number,&events[count]);
+		number = events[count++].previous;
+	}
+	return count;
+}
+
+// how many of the status bytes move into status
+unsigned int history_count_status_scalar(unsigned char *statuses, unsigned int count, unsigned char status){
+	unsigned int matches = 0;
+	for (unsigned int i=0; i<count; i++) matches += (statuses[i] & 0x0F) == status;
+	return matches;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 16 status bytes per step: every match subtracts one (a compare gives -1) from its lane's
+// byte counter, and the counters are summed before any of them could overflow
+__attribute__((target("sse2")))
+unsigned int history_count_status_vector(unsigned char *statuses, unsigned int count, unsigned char status){
+	__m128i nibble_mask = _mm_set1_epi8(0x0F);
+	__m128i wanted = _mm_set1_epi8(status);
+	unsigned int matches = 0, index = 0;
+	while (index+16 <= count){
+		__m128i counters = _mm_setzero_si128();
+		for (unsigned int step=0; step<255 && index+16 <= count; step++, index+=16){
+			__m128i bytes = _mm_loadu_si128((__m128i*)(statuses+index));
+			counters = _mm_sub_epi8(counters,_mm_cmpeq_epi8(_mm_and_si128(bytes,nibble_mask),wanted));
+		}
+		__m128i sums = _mm_sad_epu8(counters,_mm_setzero_si128());
+		matches += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums,8));
+	}
+	return matches + history_count_status_scalar(statuses+index,count-index,status);
+}
+#endif
+
+unsigned int history_count_status(unsigned char *statuses, unsigned int count, unsigned char status){
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("sse2")) return history_count_status_vector(statuses,count,status);
+#endif
+	return history_count_status_scalar(statuses,count,status);
+}
+
+// counts the events moving into status since since_ms, keeping the most recent max of them
+// newest first in recent, returns the count
+unsigned int history_transitions(unsigned char status, long long since_ms, struct HistoryEvent *recent, unsigned int max, unsigned int *recent_count){
+	struct HistoryEvent events[HISTORY_BLOCK_EVENTS];
+	unsigned int count = 0;
+	*recent_count = 0;
+	pthread_mutex_lock(&history.mutex);
+	unsigned int sealed_count = history.sealed_count;
+	for (unsigned int i=history.open_count; i>0; i--){
+		struct HistoryEvent *event = &history.open[i-1];
+		if (event->time_ms < since_ms) break;
+		if (event->new_status != status) continue;
+		if (*recent_count < max) recent[(*recent_count)++] = *event;
+		count++;
+	}
+	pthread_mutex_unlock(&history.mutex);
+
+	// blocks are in time order, newest last
+	for (unsigned int block_number=sealed_count; block_number>0; block_number--){
+		struct HistoryBlock *block = history_block_at(block_number-1);
+		if (block->header.last_time_ms < since_ms) break;
+		if ((block->header.new_statuses & (1 << status)) == 0) continue;
+		if (block->header.first_time_ms >= since_ms && *recent_count == max){
+			// every event is in range and none has to be kept, only the status column is read,
+			// the next block's is fetched meanwhile since the blocks are all over the heap
+			unsigned char *statuses = block->columns+block->header.status_offset;
+			if (block_number > 1){
+				struct HistoryBlock *next = history_block_at(block_number-2);
+				for (unsigned int i=0; i<next->header.count; i+=64) __builtin_prefetch(next->columns+next->header.status_offset+i);
+			}
+			count += history_count_status(statuses,block->header.count,status);
+			continue;
+		}
+		history_decode(block,(block_number-1)*HISTORY_BLOCK_EVENTS,events,block->header.count);
+		for (unsigned int i=block->header.count; i>0; i--){
+			if (events[i-1].time_ms < since_ms) break;
+			if (events[i-1].new_status != status) continue;
+			if (*recent_count < max) recent[(*recent_count)++] = events[i-1];
+			count++;
+		}
+	}
+	return count;
+}
+
+// rebuilds the per-patient index from the patient ids of every event
+char history_index_rebuild(){
+	struct HistoryEvent events[HISTORY_BLOCK_EVENTS];
+	if (history_reserve_patient(patients.count)==0) return 0;
+	for (unsigned int block_number=0; block_number<history.sealed_count; block_number++){
+		struct HistoryBlock *block = history_block_at(block_number);
+		history_decode(block,block_number*HISTORY_BLOCK_EVENTS,events,block->header.count);
+		for (unsigned int i=0; i<block->header.count; i++){
+			unsigned int patient_index = patient_index_from_id(events[i].patient_id);
+			if (patient_index != UINT_MAX) history.last_events[patient_index] = block_number*HISTORY_BLOCK_EVENTS+i;
+		}
+	}
+	for (unsigned int i=0; i<history.open_count; i++){
+		unsigned int patient_index = patient_index_from_id(history.open[i].patient_id);
+		if (patient_index != UINT_MAX) history.last_events[patient_index] = history.sealed_count*HISTORY_BLOCK_EVENTS+i;
+	}
+	return 1;
+}
+
+// reads the full blocks of the history file, up to a torn block. Files written before the
+// open block had a file of its own can end with the open block, it is read back as well
+char history_load(){
+	struct HistoryBlock block;
+	off_t offset = 0;
+	while (read(history.fd,&block.header,sizeof(block.header)) == sizeof(block.header)){
+		if (block.header.count == 0 || block.header.count > HISTORY_BLOCK_EVENTS || block.header.status_offset+block.header.count != block.header.size) break;
+		block.columns = malloc(block.header.size);
+		if (block.columns == NULL) return 0;
+		if (read(history.fd,block.columns,block.header.size) != block.header.size
+			|| journal_checksum(block.columns,block.header.size) != block.header.checksum){
+			free(block.columns);
+			break;
+		}
+		history.last_time_ms = block.header.last_time_ms;
+		if (block.header.count < HISTORY_BLOCK_EVENTS){
+			history_decode(&block,history.sealed_count*HISTORY_BLOCK_EVENTS,history.open,block.header.count);
+			history.open_count = block.header.count;
+			free(block.columns);
+			break;
+		}
+		if (history_publish(&block)==0) return 0;
+		offset += sizeof(block.header)+block.header.size;
+	}
+	history.file_size = offset;
+	history.written_count = history.sealed_count;
+	return 1;
+}
+
+// reads back the open block from the slot written last, if it starts the block after the full ones
+// and has more events than one left at the end of the history file
+char history_load_open(){
+	struct HistoryOpenSlot best = {.sequence = 0}, slot;
+	struct HistoryBlock block = {.columns = NULL};
+	for (int i=0; i<2; i++){
+		unsigned char *columns;
+		if (pread(history.open_fd,&slot,sizeof(slot),(off_t)i*HISTORY_OPEN_SLOT_SIZE) != sizeof(slot)
+			|| slot.block_number != history.sealed_count || slot.sequence <= best.sequence
+			|| slot.header.count >= HISTORY_BLOCK_EVENTS || slot.header.size > HISTORY_BLOCK_EVENTS*HISTORY_EVENT_MAX_BYTES
+			|| (slot.header.count > 0 && slot.header.status_offset+slot.header.count != slot.header.size)) continue;
+		columns = malloc(slot.header.size+1);
+		if (columns == NULL) return 0;
+		if (pread(history.open_fd,columns,slot.header.size,(off_t)i*HISTORY_OPEN_SLOT_SIZE+sizeof(slot)) != slot.header.size
+			|| journal_checksum(columns,slot.header.size) != slot.header.checksum){
+			free(columns);
+			continue;
+		}
+		free(block.columns);
+		best = slot;
+		block.header = slot.header;
+		block.columns = columns;
+	}
+	history.open_sequence = best.sequence;
+	if (block.columns != NULL && block.header.count > history.open_count){
+		history_decode(&block,history.sealed_count*HISTORY_BLOCK_EVENTS,history.open,block.header.count);
+		history.open_count = block.header.count;
+		history.last_time_ms = block.header.last_time_ms;
+	}
+	free(block.columns);
+	return 1;
+}
+
+// writes the open block to the older slot of the open block file, once the full blocks sealed
+// before it are written and on disk, called after the journal commits a group. The events are copied
+// under the lock and written out without it, so status changes don't wait for the disk
+void history_flush(){
+	static struct HistoryEvent events[HISTORY_BLOCK_EVENTS]; // only used under the flush mutex
+	struct HistoryBlock block = {.columns = NULL};
+	pthread_mutex_lock(&history.flush_mutex);
+	pthread_mutex_lock(&history.mutex);
+	unsigned int sealed_count = history.sealed_count, count = history.open_count;
+	char changed = history.open_fd >= 0 && (sealed_count != history.flushed_sealed || count != history.flushed_count);
+	if (changed) memcpy(events,history.open,sizeof(struct HistoryEvent)*count);
+	pthread_mutex_unlock(&history.mutex);
+	// the slot starts the block after the full ones, which have to be in the file first
+	if (changed == 0 || history_write_sealed()==0){
+		pthread_mutex_unlock(&history.flush_mutex);
+		return;
+	}
+
+	struct HistoryOpenSlot slot = {.block_number = sealed_count, .sequence = history.open_sequence+1};
+	char written = sealed_count == history.flushed_sealed || fdatasync(history.fd) == 0;
+	if (written && count > 0){
+		written = history_encode(events,count,sealed_count*HISTORY_BLOCK_EVENTS,&block);
+		slot.header = block.header;
+	}
+	off_t offset = (off_t)(slot.sequence%2)*HISTORY_OPEN_SLOT_SIZE;
+	written = written && pwrite(history.open_fd,&slot,sizeof(slot),offset) == sizeof(slot)
+		&& (count == 0 || pwrite(history.open_fd,block.columns,block.header.size,offset+sizeof(slot)) == block.header.size)
+		&& fdatasync(history.open_fd) == 0;
+	free(block.columns);
+	if (written){
+		history.open_sequence = slot.sequence;
+		history.flushed_sealed = sealed_count;
+		history.flushed_count = count;
+	}
+	else out_s("Failed to write the open block of the status history");
+	pthread_mutex_unlock(&history.flush_mutex);
+}
+
+// opens the history files, keeping the events in them only when they belong to the loaded data,
+// the history of other data is moved to <path>.old and <open path>.old
+char history_open(char *path, char *open_path, char keep){
+	char *paths[2] = {path,open_path};
+	for (int i=0; keep == 0 && i<2; i++){
+		char old_path[PATH_MAX];
+		struct stat file_stat;
+		if (stat(paths[i],&file_stat) != 0 || file_stat.st_size == 0) continue;
+		snprintf(old_path,sizeof(old_path),"%s.old",paths[i]);
+		if (rename(paths[i],old_path) != 0) return 0;
+		out_f("The status history of the previous data was moved to %s\n",old_path);
+	}
+	history.fd = open(path,O_RDWR|O_CREAT,0600);
+	history.open_fd = open(open_path,O_RDWR|O_CREAT,0600);
+	history.flushed_sealed = UINT_MAX; // written once right away
+	if (history.fd < 0 || history.open_fd < 0 || history_load()==0 || history_load_open()==0 || history_index_rebuild()==0){
+		if (history.fd >= 0) close(history.fd);
+		if (history.open_fd >= 0) close(history.open_fd);
+		history.fd = -1;
+		history.open_fd = -1;
+		return 0;
+	}
+	// the open block is in its own file before anything after the full blocks is cut off
+	history_flush();
+	if (ftruncate(history.fd,history.file_size) != 0 || lseek(history.fd,history.file_size,SEEK_SET) != history.file_size){
+		close(history.fd);
+		close(history.open_fd);
+		history.fd = -1;
+		history.open_fd = -1;
+		return 0;
+	}
+	history.running = 1;
+	return 1;
+}
+
+// writes out the open block and stops recording
+void history_close(){
+	history_flush();
+	pthread_mutex_lock(&history.mutex);
+	history.running = 0;
+	if (history.fd >= 0){
+		if (history.dropped > 0) fprintf(stderr,"%llu status history events were dropped\n",history.dropped);
+		fdatasync(history.fd);
+		close(history.fd);
+		close(history.open_fd);
+		history.fd = -1;
+		history.open_fd = -1;
+	}
+	pthread_mutex_unlock(&history.mutex);
+}
+
+// forgets every event, for the benchmarks' generated data
+void history_clear(){
+	for (unsigned int i=0; i<history.sealed_count; i++) free(history_block_at(i)->columns);
+	for (unsigned int i=0; i<HISTORY_MAX_BLOCK_SLABS; i++){
+		free(history.block_slabs[i]);
+		history.block_slabs[i] = NULL;
+	}
+	free(history.last_events);
+	history.last_events = NULL;
+	history.last_events_capacity = 0;
+	history.sealed_count = 0;
+	history.written_count = 0;
+	history.open_count = 0;
+	history.last_time_ms = 0;
+}
+
+// "2026-10-17 20:46:01" in local time
+void history_time_text(long long time_ms, char *text, unsigned int size){
+	time_t seconds = time_ms/1000;
+	struct tm local;
+	strftime(text,size,"%Y-%m-%d %H:%M:%S",localtime_r(&seconds,&local));
+}
+
+// prints the patient's most recent status changes, oldest first
+void history_display(unsigned int patient_index){
+	struct HistoryEvent events[HISTORY_DISPLAY_EVENTS];
+	char time_text[32];
+	unsigned int count = history_patient(patient_index,events,HISTORY_DISPLAY_EVENTS);
+	if (count == 0) return;
+	out_s("History:");
+	for (unsigned int i=count; i>0; i--){
+		struct HistoryEvent *event = &events[i-1];
+		history_time_text(event->time_ms,time_text,sizeof(time_text));
+		if (event->room_id == UINT_MAX)
+			out_f("\t%s\t%s -> %s\n",time_text,PatientStatusToS[event->old_status],PatientStatusToS[event->new_status]);
+		else
+			out_f("\t%s\t%s -> %s (room %u)\n",time_text,PatientStatusToS[event->old_status],PatientStatusToS[event->new_status],event->room_id);
+	}
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Record Changes
+
+
+// All changes to the tables go through these functions, so nothing is left out of the journal
+// Changes to a patient are made while holding that patient's lock, one of a fixed set
+// picked by index, so changes to different patients (and the rooms they claim) run
+// side by side. Rooms are claimed with room_reserve, never under a lock.
+#define PATIENT_LOCK_COUNT 64
+
+pthread_mutex_t patient_locks[PATIENT_LOCK_COUNT] = {[0 ... PATIENT_LOCK_COUNT-1] = PTHREAD_MUTEX_INITIALIZER};
+
+void patient_lock(unsigned int patient_index){
+	pthread_mutex_lock(&patient_locks[patient_index%PATIENT_LOCK_COUNT]);
+}
+
+void patient_unlock(unsigned int patient_index){
+	pthread_mutex_unlock(&patient_locks[patient_index%PATIENT_LOCK_COUNT]);
+}
+
+// moves a patient into a room the caller reserved, or out of their room when room_index is UINT_MAX
+// the writes of a move, made inside a view change, returns what the move is audited as
+enum AuditEventType patient_move_apply(unsigned int patient_index, unsigned int room_index){
+	unsigned int *patient_room_index = patient_room_index_at(patient_index);
+	unsigned int patient_id = *patient_id_at(patient_index);
+	enum AuditEventType audit_type = AUDIT_TRANSFER;
+	if (*patient_room_index == UINT_MAX && room_index != UINT_MAX){
+		__atomic_fetch_add(&census.admissions,1,__ATOMIC_RELAXED);
+		audit_type = AUDIT_ADMIT;
+	}
+	if (*patient_room_index != UINT_MAX && room_index == UINT_MAX){
+		__atomic_fetch_add(&census.discharges,1,__ATOMIC_RELAXED);
+		audit_type = AUDIT_DISCHARGE;
+	}
+	// columns read views copy are written atomically, a view can copy them meanwhile
+	// vacate the current room
+	if (*patient_room_index != UINT_MAX){
+		__atomic_store_n(room_patient_id_at(*patient_room_index),0,__ATOMIC_RELAXED);
+		room_set_status(*patient_room_index,VACANT);
+		view_mark(&rooms,*patient_room_index);
+	}
+	if (room_index != UINT_MAX){
+		__atomic_store_n(room_patient_id_at(room_index),patient_id,__ATOMIC_RELAXED);
+		room_set_status(room_index,FULL);
+		view_mark(&rooms,room_index);
+	}
+	__atomic_store_n(patient_room_index,room_index,__ATOMIC_RELAXED);
+	view_mark(&patients,patient_index);
+	return audit_type;
+}
+
+// journals and audits a move once it is made
+void patient_move_record(unsigned int patient_index, unsigned int room_index, enum AuditEventType audit_type){
+	unsigned int patient_id = *patient_id_at(patient_index);
+	journal_patient_move(patient_id,room_index);
+	audit_record(audit_type,patient_id,room_index == UINT_MAX ? UINT_MAX : *room_id_at(room_index),0,NULL);
+}
+
+// the writes of a status change, made inside a view change, returns the old status
+unsigned char patient_status_apply(unsigned int patient_index, enum PatientStatus status){
+	unsigned char *patient_status = patient_status_at(patient_index);
+	unsigned char old_status = *patient_status;
+	census_add(&census.patients_by_status[old_status],-1);
+	census_add(&census.patients_by_status[status],1);
+	__atomic_store_n(patient_status,(unsigned char)status,__ATOMIC_RELAXED);
+	view_mark(&patients,patient_index);
+	return old_status;
+}
+
+// journals, audits and keeps the history of a status change once it is made
+void patient_status_record(unsigned int patient_index, unsigned char old_status, enum PatientStatus status){
+	unsigned int room_index = *patient_room_index_at(patient_index);
+	journal_patient_status(*patient_id_at(patient_index),status);
+	audit_record(AUDIT_SET_STATUS,*patient_id_at(patient_index),UINT_MAX,status,NULL);
+	history_record(patient_index,old_status,status,room_index == UINT_MAX ? UINT_MAX : *room_id_at(room_index));
+}
+
+// moves a patient into a room reserved for them, or out of their room with UINT_MAX,
+// returns 0 if the room wasn't reserved
+char patient_move(unsigned int patient_index, unsigned int room_index){
+	if (room_index != UINT_MAX && *room_status_at(room_index) != RESERVED) return 0;
+	view_change_begin();
+	enum AuditEventType audit_type = patient_move_apply(patient_index,room_index);
+	view_change_end();
+	patient_move_record(patient_index,room_index,audit_type);
+	return 1;
+}
+
+void patient_set_status(unsigned int patient_index, enum PatientStatus status){
+	view_change_begin();
+	unsigned char old_status = patient_status_apply(patient_index,status);
+	view_change_end();
+	patient_status_record(patient_index,old_status,status);
+}
+
+// a move and a status change together, admitting or discharging, in one view change so
+// no view sees a patient in their new room with the old status or the other way round
+char patient_move_with_status(unsigned int patient_index, unsigned int room_index, enum PatientStatus status){
+	if (room_index != UINT_MAX && *room_status_at(room_index) != RESERVED) return 0;
+	view_change_begin();
+	enum AuditEventType audit_type = patient_move_apply(patient_index,room_index);
+	unsigned char old_status = patient_status_apply(patient_index,status);
+	view_change_end();
+	patient_move_record(patient_index,room_index,audit_type);
+	patient_status_record(patient_index,old_status,status);
+	return 1;
+}
+
+// returns the new patient's index, UINT_MAX if it couldn't be added
+unsigned int patient_add(unsigned int patient_id, char *name){
+	struct StringRef name_ref;
+	if (string_intern(name,&name_ref)==0) return UINT_MAX;
+	view_change_begin();
+	unsigned int patient_index = table_append(&patients);
+	if (patient_index == UINT_MAX){
+		view_change_end();
+		return UINT_MAX;
+	}
+	*patient_id_at(patient_index) = patient_id;
+	*patient_name_ref_at(patient_index) = name_ref;
+	*patient_status_at(patient_index) = DISMISSED;
+	*patient_room_index_at(patient_index) = UINT_MAX;
+	if (patient_id_index_insert(patient_id,patient_index)==0){
+		// drop the record again so the table and index stay consistent
+		patients.count--;
+		data_file_sync_count(&patients);
+		view_change_end();
+		return UINT_MAX;
+	}
+	census_add(&census.patients_by_status[DISMISSED],1);
+	view_change_end();
+	name_index_add(patient_index); // without it the patient can still be found by id
+	journal_patient_add(patient_id,patient_name_at(patient_index));
+	audit_record(AUDIT_REGISTER,patient_id,UINT_MAX,0,NULL);
+	return patient_index;
+}
+
+// returns the new user's index, UINT_MAX if it couldn't be added
+unsigned int user_add(struct User *user){
+	unsigned int user_index = table_append(&users);
+	if (user_index == UINT_MAX) return UINT_MAX;
+	*user_at(user_index) = *user;
+	if (user_directory_add(user_index)==0){
+		// drop the record again so the table and directory stay consistent
+		users.count--;
+		data_file_sync_count(&users);
+		return UINT_MAX;
+	}
+	journal_user_add(user);
+	audit_record(AUDIT_REGISTER_USER,0,UINT_MAX,user->privilege,string_at(user->name));
+	return user_index;
+}
+
+// Admission Planning
+// places a batch of patients who are in no room yet, each with the status they were triaged
+// with, in one pass: a heap hands out the most severe patients first, in order of registration
+// within a status, and each takes the next vacant room off the vacancy bitmap, which is already
+// in room order; every room is reserved while planning, then the whole plan is committed or released
+struct AdmissionPlan {
+	unsigned int *patient_indexes; // in order of admission
+	unsigned char *statuses; // the status each of them is admitted with
+	unsigned int *room_indexes; // the room reserved for each of them
+	unsigned int count; // patients given a room
+	unsigned int waiting; // patients left without one once the rooms ran out
+};
+
+// the smallest key is the most severe patient, then the one registered first
+unsigned long long admission_key(unsigned int patient_index, enum PatientStatus status){
+	return (unsigned long long)(SEVERE - status) << 32 | patient_index;
+}
+
+void admission_heap_sift_down(unsigned long long *heap, unsigned int count, unsigned int i){
+	while (0==0){
+		unsigned int smallest = i;
+		unsigned int left = i*2+1;
+		if (left < count && heap[left] < heap[smallest]) smallest = left;
+		if (left+1 < count && heap[left+1] < heap[smallest]) smallest = left+1;
+		if (smallest == i) return;
+		unsigned long long swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+void admission_plan_free(struct AdmissionPlan *plan){
+	free(plan->patient_indexes);
+	free(plan->statuses);
+	free(plan->room_indexes);
+	plan->count = 0;
+}
+
+// plans the given patients, each listed once, those already in a room are left out
+// returns 0 if memory ran out
+char admission_plan(struct AdmissionPlan *plan, unsigned int *patient_indexes, unsigned char *statuses, unsigned int count){
+	unsigned long long *heap = malloc(sizeof(unsigned long long)*count+1);
+	plan->patient_indexes = malloc(sizeof(unsigned int)*count+1);
+	plan->statuses = malloc(count+1);
+	plan->room_indexes = malloc(sizeof(unsigned int)*count+1);
+	plan->count = 0;
+	plan->waiting = 0;
+	if (heap == NULL || plan->patient_indexes == NULL || plan->statuses == NULL || plan->room_indexes == NULL){
+		free(heap);
+		admission_plan_free(plan);
+		return 0;
+	}
+
+	unsigned int heap_count = 0;
+	for (unsigned int i=0; i<count; i++){
+		if (*patient_room_index_at(patient_indexes[i]) != UINT_MAX || statuses[i] >= DISMISSED) continue;
+		heap[heap_count++] = admission_key(patient_indexes[i],statuses[i]);
+	}
+	for (unsigned int i=heap_count/2; i>0; i--) admission_heap_sift_down(heap,heap_count,i-1);
+
+	unsigned int room_index = 0, ward_index = 0;
+	while (heap_count > 0){
+		unsigned long long key = heap[0];
+		heap[0] = heap[--heap_count];
+		admission_heap_sift_down(heap,heap_count,0);
+		if (room_index != UINT_MAX) room_index = room_reserve_vacant(ward_index);
+		if (room_index == UINT_MAX){
+			plan->waiting++;
+			continue;
+		}
+		// the next patient goes to the same ward while it has rooms
+		ward_index = room_ward_slots[room_index]/ROOM_WARD_SPAN;
+		plan->patient_indexes[plan->count] = (unsigned int)key;
+		plan->statuses[plan->count] = SEVERE - (key >> 32);
+		plan->room_indexes[plan->count++] = room_index;
+	}
+	free(heap);
+	return 1;
+}
+
+void admission_commit(struct AdmissionPlan *plan){
+	for (unsigned int i=0; i<plan->count; i++){
+		patient_move_with_status(plan->patient_indexes[i],plan->room_indexes[i],plan->statuses[i]);
+	}
+	admission_plan_free(plan);
+}
+
+void admission_release(struct AdmissionPlan *plan){
+	for (unsigned int i=0; i<plan->count; i++) room_release(plan->room_indexes[i]);
+	admission_plan_free(plan);
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Room Operations
+
+
+// the chosen room is reserved for the caller, who has to fill or release it
+char find_vacant_room(unsigned int *room_id,unsigned int *room_index){
+	// pick a room
+	while (0==0){
+		title("room selection menu");
+		unsigned int first_index = first_vacant_room();
+		if (first_index == UINT_MAX){
+			out_s("There are no empty rooms available");
+			return 0;
+		}
+		out_f("Please enter new room ID (first vacant room is %u)\n",*room_id_at(first_index));
+		*room_id = prompt_d();
+		*room_index = room_index_from_id(*room_id);
+		if (*room_index == UINT_MAX){
+			out_s("Incorrect room ID");
+			out_s("Reselect room? (y)");
+			if (prompt_y()==1) continue;
+			return 0;
+		}
+		if (room_reserve(*room_index)==0){
+			out_s("Room currently full");
+			out_s("Reselect room? (y)");
+			if (prompt_y()==1) continue;
+			return 0;
+		}
+		break;
+	}
+	return 1;
+}
+
+// collects patients and their triage status, then admits them all at once, most severe first
+void admit_patient_batch(){
+	unsigned int *patient_indexes = NULL;
+	unsigned char *statuses = NULL;
+	unsigned int count = 0;
+	unsigned int capacity = 0;
+	struct AdmissionPlan plan;
+
+	title("admission batch menu");
+	out_s("Enter the ID and status of each patient to admit, an empty ID ends the batch");
+	while (0==0){
+		out_f("Patient %u ID:\n",count+1);
+		char *input = prompt_buffer();
+		if (input[0] == 0) break;
+		unsigned int patient_index = patient_index_from_id(atoi(input));
+		if (patient_index == UINT_MAX){
+			out_s("There is no patient with this ID");
+			continue;
+		}
+		if (*patient_room_index_at(patient_index) != UINT_MAX){
+			out_s("Patient is already in a room");
+			continue;
+		}
+		unsigned int i = 0;
+		while (i < count && patient_indexes[i] != patient_index) i++;
+		if (i < count){
+			out_s("Patient is already in this batch");
+			continue;
+		}
+
+		out_f("Status of %s:\n",patient_name_at(patient_index));
+		out_s("(V) Visit\n(R) Recover\n(I) Ill\n(S) Severe\nOther to leave the patient out");
+		const char* options = "vris";
+		char option = tolower(prompt_c());
+		char *chr = option == 0 ? NULL : strchr(options,option);
+		if (chr == NULL) continue;
+
+		if (count == capacity){
+			capacity = capacity == 0 ? 16 : capacity*2;
+			unsigned int *new_indexes = realloc(patient_indexes,sizeof(unsigned int)*capacity);
+			if (new_indexes != NULL) patient_indexes = new_indexes;
+			unsigned char *new_statuses = realloc(statuses,capacity);
+			if (new_statuses != NULL) statuses = new_statuses;
+			if (new_indexes == NULL || new_statuses == NULL){
+				out_s("Failed to allocate memory for the batch");
+				break;
+			}
+		}
+		patient_indexes[count] = patient_index;
+		statuses[count++] = chr-options;
+	}
+
+	out_decoration(S_SEPARATOR);
+	char planned = count > 0 && admission_plan(&plan,patient_indexes,statuses,count);
+	free(patient_indexes);
+	free(statuses);
+	if (planned == 0){
+		out_s(S_CANCELLED);
+		return;
+	}
+	if (plan.count == 0){
+		out_s("There are no empty rooms available");
+		admission_release(&plan);
+		prompt_c();
+		return;
+	}
+	for (unsigned int i=0; i<plan.count; i++){
+		unsigned int patient_index = plan.patient_indexes[i];
+		out_f("[ %u | %s\t%s\t ] Room: %u\n",*patient_id_at(patient_index),patient_name_at(patient_index),
+			PatientStatusToS[plan.statuses[i]],*room_id_at(plan.room_indexes[i]));
+	}
+	if (plan.waiting > 0) out_f("%u more patients will have to wait, there are no more empty rooms\n",plan.waiting);
+
+	out_f("Admit these %u patients? (y)\n",plan.count);
+	if (prompt_y()==0){
+		admission_release(&plan);
+		out_s(S_CANCELLED);
+		return;
+	}
+	unsigned int admitted = plan.count;
+	admission_commit(&plan);
+	out_f("%u patients successfully admitted\n",admitted);
+	prompt_c();
+}
+
+void show_statistics(){
+	char text[STATS_TEXT_LEN];
+	out_decoration(S_SEPARATOR);
+	stats_format(text,sizeof(text));
+	out_f("%s",text);
+	prompt_c();
+}
+
+void check_empty_rooms(){
+	out_decoration(S_SEPARATOR);
+	struct ReadView *view = read_view_pin();
+	if (view == NULL){
+		out_s("Failed to read the rooms");
+		prompt_c();
+		return;
+	}
+	unsigned int vacant_rooms = view->vacant_rooms, first_index = view->first_vacant_room;
+	read_view_unpin();
+	if (first_index == UINT_MAX){
+		out_s("There are no empty rooms available");
+		prompt_c();
+		return;
+	}
+	out_f("There are %u rooms available, the first of which is %u\n",vacant_rooms,*room_id_at(first_index));
+	prompt_c();
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Patient Operations
+
+
+// lists the patients matching a name, returns the index of the one picked or UINT_MAX
+unsigned int patient_search_menu(char *query){
+	struct NameMatch matches[NAME_SEARCH_MAX_RESULTS];
+	unsigned int match_count = name_search(query,matches,NAME_SEARCH_MAX_RESULTS);
+	if (match_count == 0){
+		out_s("No patient matches this name");
+		return UINT_MAX;
+	}
+	for (unsigned int i=0; i<match_count; i++){
+		unsigned int patient_index = matches[i].patient_index;
+		out_f("(%u) [ %u | %s ]\n",i+1,*patient_id_at(patient_index),patient_name_at(patient_index));
+	}
+	out_s("Please select a patient (other to cancel):");
+	unsigned int choice = prompt_d();
+	if (choice < 1 || choice > match_count) return UINT_MAX;
+	return matches[choice-1].patient_index;
+}
+
+unsigned char patient_selection_loop(unsigned int *patient_id, unsigned int *patient_index){
+	while (0 == 0){
+		title("patient selection menu");
+		out_s("Please enter Patient ID or name:");
+		char *input = prompt_buffer();
+
+		// anything but a number is searched for by name
+		if (input[0] != 0 && !isdigit(input[0])){
+			*patient_id = 0; // no id to register the patient under
+			*patient_index = patient_search_menu(input);
+			if (*patient_index == UINT_MAX) break;
+			*patient_id = *patient_id_at(*patient_index);
+		}
+		else{
+			*patient_id = atoi(input);
+			// cancel if not found
+			*patient_index = patient_index_from_id(*patient_id);
+			if (*patient_index == UINT_MAX) break;
+		}
+
+		display_patient_data(*patient_index);
+		out_s("Is this the correct patient? (y)");
+		if (prompt_y() == 0) continue;
+
+		return 1;
+	}
+	return 0;
+}
+
+void view_patient(){
+	int patient_id;
+	unsigned int patient_index;
+	char success = 0;
+
+	// find patient
+	while (success == 0){
+		success = patient_selection_loop(&patient_id,&patient_index);
+		if (success == 1) break;
+		out_s("There is no patient with this ID, enter new ID? (y)");
+		if (prompt_y()==0) return;
+	}
+	
+}
+
+char register_patient(unsigned int patient_id,unsigned int *patient_index){
+	char name[STRING_MAX_LEN];
+	char success = 0;
+	out_decoration("");
+	out_s("Leave any field empty to exit");
+	out_s("Please enter new patient's name:");
+	
+	while (0==0){
+		char last_name[50];
+		out_decoration(S_SEPARATOR);
+		out_s("First Name:");
+		prompt_s(name);
+
+		if (strlen(name)==0) return 0;//allow exit on empty prompt
+		if (validate_string(name,&VALID_PATIENT)==0) continue;
+
+		out_s("Last Name:");
+		prompt_s(last_name);
+
+		if (strlen(name)==0) return 0;//allow exit on empty prompt
+		if (validate_string(last_name,&VALID_PATIENT)==0) continue;
+		
+		strcat(name," ");
+		strcat(name,last_name);
+
+		out_f("is patient name: [%s] acceptable? (y)\n",name);
+		if (prompt_y()==1){
+			break;
+		}
+	}
+	*patient_index = patient_add(patient_id,name);
+	if (*patient_index == UINT_MAX){
+		out_s("Failed to allocate memory for the new patient");
+		return 0;
+	}
+	out_f("Patient %s successfully created with id : %d\n",name,patient_id);
+	out_decoration("");
+	out_s("Warning!:");
+	out_s("Patient Status can only be updated after admission to hospital");
+	out_s("To admit patient to hospital use transfer patient");
+	return 1;
+}
+
+char transfer_patient(unsigned int passed_patient_index){
+	int patient_id;
+	unsigned int patient_room_index;
+	unsigned int patient_index;
+	unsigned int new_room_id;
+	unsigned int new_room_index;
+	char is_admission = 0, success;
+	// Retreive patient
+	if (passed_patient_index==UINT_MAX){
+		// find patient
+		success = patient_selection_loop(&patient_id,&patient_index);
+		if (success == 0) return 0;
+	}
+	else{
+		// set to passed value
+		success = 1;
+		patient_index = passed_patient_index;
+		patient_id = *patient_id_at(patient_index);
+	}
+	patient_room_index = *patient_room_index_at(patient_index);
+	
+	// Allow admission of patient to hospital
+	if (patient_room_index == UINT_MAX && is_admission == 0){
+		out_decoration(S_SEPARATOR);
+		out_s("Patient not currently in any room, admit patient to hospital? (y)");
+		if (prompt_y()==1) is_admission = 1;
+		else{
+			out_s(S_CANCELLED);
+			return 0;
+		}
+		
+	}
+	
+	while (0==0){
+		if (find_vacant_room(&new_room_id,&new_room_index)==0){
+			out_s(S_CANCELLED);
+			return 0;
+		}
+		
+		// Confirm operation
+		out_f("Transfer patient %s to room %u ? (y)\n",
+			patient_name_at(patient_index),new_room_id);
+		if (prompt_y()==1){
+			
+			if (is_admission) patient_move_with_status(patient_index,new_room_index,VISIT);
+			else patient_move(patient_index,new_room_index);
+			out_f("patient %s successfully transfered to room %u\n",
+			patient_name_at(patient_index),new_room_id);
+
+			if (is_admission) out_s("Remember to update patient status");
+			
+			return 1;
+		}
+		room_release(new_room_index);
+		out_s("cancel operation? (y)");
+		if (prompt_y()==1){
+			out_s(S_CANCELLED);
+			break;
+		}
+		
+	}
+	return 0;
+}
+
+void update_patient(){
+	unsigned int patient_id;
+	unsigned int patient_room_index;
+	unsigned int patient_index;
+
+	while (0==0){
+		char success = patient_selection_loop(&patient_id,&patient_index);
+
+		if (success == 0 && patient_id == 0){
+			out_s(S_CANCELLED);
+			return;
+		}
+		if (success == 0){
+			out_s("Patient not registered, register a new patient? (y)");
+			if (prompt_y()==1){
+				success = register_patient(patient_id,&patient_index);
+				if (success==0){
+					out_s(S_CANCELLED);
+					return;
+				}
+				out_s("Would you lik to admit patient? (y)");
+				if (prompt_y()==1){
+					if (transfer_patient(patient_index)) break;
+					return;
+				}
+			}
+			else{
+				out_s(S_CANCELLED);
+				return;
+			}
+		}
+		
+		patient_room_index = *patient_room_index_at(patient_index);
+		
+		// Allow re-entry of patient id
+		if (patient_room_index == UINT_MAX){
+			out_decoration(S_SEPARATOR);
+			out_s("Patient not currently in any room, return? (y)");
+			if (prompt_y()==0)continue;
+			return;
+		}
+		break;
+	}
+
+	out_decoration(S_SEPARATOR);
+	out_s("Enter New Status:");
+	out_s("(V) Visit\n(R) Recover\n(I) Ill\n(S) Severe\nOther to cancel");
+	out_decoration("");
+	
+	// convert char to enum
+	const char* options = "vris";
+	char *chr = strchr(options,tolower(prompt_c()));
+	if (chr != NULL){
+		patient_set_status(patient_index,(int)(chr-options));
+		out_f("patient status updated to %s\n",PatientStatusToS[*patient_status_at(patient_index)]);
+		return;
+	}
+	out_s(S_CANCELLED);
+}
+
+void discharge_patient(){
+	int patient_id;
+	unsigned int patient_room_index;
+	unsigned int patient_index;
+	// Uses find patient in room function to retreive patient
+	while (0==0){
+		char success = patient_selection_loop(&patient_id,&patient_index);
+
+		if (success == 0) return;
+		
+		patient_room_index = *patient_room_index_at(patient_index);
+		
+		// Allow re-entry of patient id
+		if (patient_room_index == UINT_MAX){
+			out_decoration(S_SEPARATOR);
+			out_s("Patient not currently in any room, enter new id? (y)");
+			if (prompt_y()==0)continue;
+			out_s(S_CANCELLED);
+			return;
+		}
+		break;
+	}
+	
+	// Clear the room's patient data and change patient status
+	patient_move_with_status(patient_index,UINT_MAX,DISMISSED); // special value for later use
+
+	// Confirm operation success
+	out_decoration(S_SEPARATOR);
+	out_f("Patient %s has been successfully discharged from room %u\n",patient_name_at(patient_index),*room_id_at(patient_room_index));
+	prompt_c();
+}
+
+//------------------------------------------------------------------------------------------------------
+// User Operations
+
+
+void register_user(){
+	struct User user = {0};
+	char name[STRING_MAX_LEN];
+	char password[STRING_MAX_LEN];
+	char pass[STRING_MAX_LEN];
+	char success = 0;
+	out_decoration("");
+	out_s("Leave any field empty to exit");
+	out_s("Please enter new user's data:");
+
+	// Username Loop
+	while (0==0){
+		out_decoration(S_SEPARATOR);
+		out_s("Username:");
+		prompt_s(name);
+
+		if (strlen(name)==0) return;//allow exit on empty prompt
+		if (validate_string(name,&VALID_USERNAME)==0) continue;
+
+		//if name is already found ask for a new name
+		if (user_index_from_name(name)!=UINT_MAX){
+			out_s("User name already in use");
+			continue;
+		}
+
+		out_f("is username: [%s] acceptable? (y)\n",name);
+		if (prompt_y()==1){
+			break;
+		}
+	}
+
+	// Password Loop
+	while (0==0){
+		out_decoration(S_SEPARATOR);
+		out_s("Password:");
+		prompt_s(password);
+
+		if (strlen(password)==0) return; //allow exit on empty prompt
+		if (validate_string(password,&VALID_PASSWORD) == 0) continue; 
+
+		out_s("Re-enter Password:");
+		prompt_s(pass);
+
+		if (strlen(pass)==0) return; //allow exit on empty prompt
+		if (strcmp(pass,password)!=0){
+			out_s("Password is incorrect");
+			continue;
+		}
+		break;
+	}
+	
+	//privelage loop
+	success = 0;
+	while (success==0){
+		out_decoration(S_SEPARATOR);
+		out_s("Privelage Level:");
+		out_s("(A) Admin");
+		out_s("(S) Staff");
+		out_decoration("");
+
+		switch (tolower(prompt_c()))
+		{
+		case 'a':
+			// warn user in case they choose to make an admin
+			// should probably re-check for current admin's password
+			// to avoid security risk of impersonation nand backdoor creation
+			out_s("Warning!!!: an admin would have the same privelage as yourself");
+			out_s("Are you sure you want to do this? (y)");
+			if (prompt_y()==1){
+				user.privilege=ADMIN;
+				success = 1;
+			}
+			break;
+		
+		case 's':
+			user.privilege=STAFF;
+			success = 1;
+			break;
+		
+		default:
+			break;
+		}
+	}
+
+	user_set_password(&user,password);
+	if (string_append(name,&user.name)==0 || user_add(&user) == UINT_MAX){
+		out_s("Failed to allocate memory for the new user");
+		return;
+	}
+	out_f("User %s successfully created with %s privileges\n",name,PrivsToS[user.privilege]);
+
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Menu Loops
+
+
+// session loop allows taking multiple actions wthin the same session
+void session_loop(struct User *user){
+	char exit = 0;
+	char action;
+	strcpy(audit_actor,string_at(user->name));
+	while (exit == 0){
+		// make the previous action's changes durable before showing the menu again
+		if (journal_commit()==0) out_s("Changes can no longer be saved, the journal could not be written");
+		title("main menu");
+		out_s("What would you like to do?");
+		if (user->privilege == ADMIN)
+			out_s("(U) Register New User");
+		out_s("(C) Check Empty Rooms");
+		if (user->privilege == ADMIN || user->privilege == STAFF){
+			out_s("(V) View Patient");
+			out_s("(S) Update Patient Status (or register patient)");
+			out_s("(T) Transfer Patient (or admit patient)");
+			out_s("(B) Admit a Batch of Patients");
+			out_s("(D) Discharge Patient");
+		}
+		if (user->privilege == ADMIN)
+			out_s("(O) Operation Statistics");
+		out_s("(E) Exit (Logout)");
+		out_decoration("");
+
+		// time the chosen operation, prompts included
+		enum Operation operation = OP_COUNT;
+		char failed = 0;
+		action = tolower(prompt_c());
+		long long start = monotonic_ns();
+		switch (action)
+		{
+		case 'u':
+			if (user->privilege != ADMIN) break;
+			register_user();
+			operation = OP_REGISTER_USER;
+			break;
+		
+		case 'c':
+			check_empty_rooms();
+			operation = OP_EMPTY_ROOMS;
+			break;
+
+		case 'v':
+			if (user->privilege != ADMIN && user->privilege != STAFF) break;
+			view_patient();
+			operation = OP_VIEW;
+			break;
+		
+		case 's':
+			if (user->privilege != ADMIN && user->privilege != STAFF) break;
+			update_patient();
+			operation = OP_SET_STATUS;
+			break;
+		
+		case 't':
+			if (user->privilege != ADMIN && user->privilege != STAFF) break;
+			failed = transfer_patient(UINT_MAX)==0;
+			operation = OP_TRANSFER;
+			break;
+		
+		case 'b':
+			if (user->privilege != ADMIN && user->privilege != STAFF) break;
+			admit_patient_batch();
+			operation = OP_ADMIT_BATCH;
+			break;
+
+		case 'd':
+			if (user->privilege != ADMIN && user->privilege != STAFF) break;
+			discharge_patient();
+			operation = OP_DISCHARGE;
+			break;
+		
+		case 'o':
+			if (user->privilege != ADMIN) break;
+			show_statistics();
+			operation = OP_STATS;
+			break;
+
+		case 'e':
+			exit = 1;
+			break;
+		default:
+			break;
+		}
+		if (operation != OP_COUNT) stats_record(operation,start,failed);
+	}
+}
+
+// returns the user logged in as, NOT_A_USER if the login failed
+struct User* login_attempt(){
+	// Get login details
+	// Note: taking all details at once to make security better
+	char name[STRING_MAX_LEN];
+	char password[STRING_MAX_LEN];
+	title("sign-in menu");
+	out_s("Please enter login information:");
+	out_s("Username:");
+	prompt_s(name);
+	out_s("Password:");
+	prompt_s(password);
+	out_decoration(S_SEPARATOR);
+	long long start = monotonic_ns();
+	unsigned int user_index = user_index_from_login(name,password);
+	stats_record(OP_LOGIN,start,user_index == UINT_MAX);
+	if (user_index != UINT_MAX){
+		out_f("Succesfully logged in as %s\n",name);
+		prompt_c();
+		// return current user for further actions
+		return user_at(user_index);
+	}
+	// don't provide exact information about reason for refusal for security reasons
+	out_f("Failed to login as %s. Either the username or password is wrong\n",name);
+	prompt_c();
+	return &NOT_A_USER;
+}
+
+// Login loop to allow multiple login attempts
+struct User* login_loop(){
+	struct User *user = &NOT_A_USER;
+	char action;
+	char exit = 0;
+
+	// check if an admin is availble
+	if (admin_available() == 0){
+		title("login menu");
+		out_s("No admins currently available, signing in as root user");
+		out_s("Please setup an Admin as soon as possible to avoid security risks and allow regular logins");
+		prompt_c();
+		return &ROOT_ADMIN;
+	}
+	
+	while (user->privilege == NOPRV && exit == 0){
+		title("login menu");
+		out_s("Welcome to Hospital Staff Login, what would you like to do?");
+		out_s("(G) Login as a Guest");
+		out_s("(U) Login as a User");
+		out_s("(E) Exit");
+		out_decoration("");
+		switch (tolower(prompt_c()))
+		{
+		case 'g':
+			out_s("Succesfully logged in as a guest account");
+			user = &GUEST_USER;
+			break;
+		
 		case 'u':
-			if (user.privilege != ADMIN) break;
-			register_user();
+			user = login_attempt();
 			break;
 		
-		case 'c':
-			check_empty_rooms();
+		case 'e':
+			exit = 1;
 			break;
+		
+		default:
+			break;
+		}
+	}
+	return user;
+}
+//------------------------------------------------------------------------------------------------------
+// Commands
+
+
+// Text commands shared by batch mode and the server, one command per line:
+//   login <name> <password>
+//   guest
+//   view <id>
+//   search <name>              (ids and names of the closest matches, best first)
+//   empty-rooms
+//   census
+//   register <id> <first name> <last name>
+//   admit <id> [room id]       (first vacant room when no room is given)
+//   transfer <id> [room id]
+//   admit-batch <id>[:<status>] ...   (most severe first, visit when no status is given)
+//   discharge <id>
+//   set-status <id> <visit|recover|ill|severe>
+//   history <id>               (the patient's most recent status changes, newest first)
+//   transitions <status> [hours]   (how many moved into the status in the last hours, 24 by
+//                              default, and the most recent of them)
+//   register-user <name> <password> <admin|staff>
+//   stats                      (admins only, count, failures, p50 and p99 us per operation)
+//   promote                    (admins only, turns a standby into a primary)
+// Commands are checked against the privileges of the session's user, the same way
+// the menus are. Each one returns NULL on success, with its result in the session's
+// detail text, or the reason it failed.
+#define COMMAND_LINE_LEN 512
+#define COMMAND_MAX_ARGS 64 // an admission batch takes one argument per patient
+
+struct Session {
+	struct User *user; // the users table's record, or one of NOT_A_USER, GUEST_USER and ROOT_ADMIN
+	char detail[512]; // details reported with a successful result
+};
+
+// parses a whole decimal number, returns 0 if the text is anything else
+char parse_id(char *text, unsigned int *id){
+	char *end;
+	if (!isdigit(text[0])) return 0;
+	unsigned long value = strtoul(text,&end,10);
+	if (*end != 0 || value > UINT_MAX) return 0;
+	*id = value;
+	return 1;
+}
+
+// accepts the full status name or its first letter, like the menu, but not dismissed
+char parse_status(char *text, unsigned char *status){
+	for (int i=VISIT; i<DISMISSED; i++){
+		if (strcasecmp(text,PatientStatusToS[i])==0 || (text[0] != 0 && text[1] == 0 && tolower(text[0]) == tolower(PatientStatusToS[i][0]))){
+			*status = i;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+char string_is_valid(char *string, struct StringRule *rule){
+	int length = strlen(string);
+	return length >= rule->min_length && length <= rule->max_length
+		&& invalid_char_index(string,length,rule) == -1;
+}
+
+// reserves the requested room, a vacant one in the requested ward (ward:<id>), or when
+// neither is given a vacant one in the preferred ward or the next ward with one
+char* command_pick_room(char *room_text, unsigned int ward_index, unsigned int *room_index){
+	unsigned int room_id, ward_id;
+	if (room_text == NULL){
+		*room_index = room_reserve_vacant(ward_index);
+		if (*room_index == UINT_MAX) return "no vacant rooms";
+		return NULL;
+	}
+	if (strncmp(room_text,"ward:",5)==0){
+		if (parse_id(room_text+5,&ward_id)==0) return "invalid ward id";
+		ward_index = ward_index_from_id(ward_id);
+		if (ward_index == UINT_MAX) return "no ward with this id";
+		*room_index = ward_reserve_vacant(ward_index);
+		if (*room_index == UINT_MAX) return "no vacant rooms in this ward";
+		return NULL;
+	}
+	if (parse_id(room_text,&room_id)==0) return "invalid room id";
+	*room_index = room_index_from_id(room_id);
+	if (*room_index == UINT_MAX) return "no room with this id";
+	if (room_reserve(*room_index)==0) return "room currently full";
+	return NULL;
+}
+
+char* command_login(struct Session *session, char **args, int arg_count){
+	if (arg_count != 3) return "usage: login <name> <password>";
+	unsigned int user_index = user_index_from_login(args[1],args[2]);
+	if (user_index == UINT_MAX) return "either the username or password is wrong";
+	session->user = user_at(user_index);
+	snprintf(session->detail,sizeof(session->detail),"%s %s",string_at(session->user->name),PrivsToS[session->user->privilege]);
+	return NULL;
+}
+
+char* command_register(struct Session *session, char **args, int arg_count){
+	unsigned int patient_id;
+	char name[STRING_MAX_LEN];
+	if (arg_count != 4) return "usage: register <id> <first name> <last name>";
+	if (parse_id(args[1],&patient_id)==0) return "invalid patient id";
+	if (patient_index_from_id(patient_id) != UINT_MAX) return "patient id already registered";
+	for (int i=2; i<4; i++){
+		if (string_is_valid(args[i],&VALID_PATIENT)==0)
+			return "names must be 1 to 20 alphabetic characters";
+	}
+	snprintf(name,sizeof(name),"%s %s",args[2],args[3]);
+	if (patient_add(patient_id,name) == UINT_MAX) return "failed to allocate memory for the new patient";
+	snprintf(session->detail,sizeof(session->detail),"%u %s",patient_id,name);
+	return NULL;
+}
+
+// admit and transfer only differ in whether the patient must already be in a room
+// called with the patient locked
+char* command_move_patient(struct Session *session, unsigned int patient_index, char *room_text, char is_admission){
+	unsigned int room_index;
+	unsigned int patient_room_index = *patient_room_index_at(patient_index);
+	if (is_admission && patient_room_index != UINT_MAX) return "patient already in a room";
+	if (!is_admission && patient_room_index == UINT_MAX) return "patient not currently in any room";
+
+	// a transfer stays in the patient's ward when it can
+	unsigned int ward_index = is_admission ? 0 : room_ward_slots[patient_room_index]/ROOM_WARD_SPAN;
+	char *error = command_pick_room(room_text,ward_index,&room_index);
+	if (error != NULL) return error;
+	char moved = is_admission ? patient_move_with_status(patient_index,room_index,VISIT) : patient_move(patient_index,room_index);
+	if (moved == 0){
+		room_release(room_index);
+		return "room currently full";
+	}
+	snprintf(session->detail,sizeof(session->detail),"%u room %u",*patient_id_at(patient_index),*room_id_at(room_index));
+	return NULL;
+}
+
+char* command_move(struct Session *session, char **args, int arg_count, char is_admission){
+	unsigned int patient_id, patient_index;
+	if (arg_count < 2 || arg_count > 3) return is_admission ? "usage: admit <id> [room | ward:<id>]" : "usage: transfer <id> [room | ward:<id>]";
+	if (parse_id(args[1],&patient_id)==0) return "invalid patient id";
+	patient_index = patient_index_from_id(patient_id);
+	if (patient_index == UINT_MAX) return "no patient with this id";
+	patient_lock(patient_index);
+	char *error = command_move_patient(session,patient_index,arg_count == 3 ? args[2] : NULL,is_admission);
+	patient_unlock(patient_index);
+	return error;
+}
+
+char* command_discharge(struct Session *session, char **args, int arg_count){
+	unsigned int patient_id, patient_index;
+	if (arg_count != 2) return "usage: discharge <id>";
+	if (parse_id(args[1],&patient_id)==0) return "invalid patient id";
+	patient_index = patient_index_from_id(patient_id);
+	if (patient_index == UINT_MAX) return "no patient with this id";
+	patient_lock(patient_index);
+	unsigned int room_index = *patient_room_index_at(patient_index);
+	if (room_index != UINT_MAX){
+		patient_move_with_status(patient_index,UINT_MAX,DISMISSED);
+	}
+	patient_unlock(patient_index);
+	if (room_index == UINT_MAX) return "patient not currently in any room";
+	snprintf(session->detail,sizeof(session->detail),"%u from room %u",patient_id,*room_id_at(room_index));
+	return NULL;
+}
+
+char* command_set_status(struct Session *session, char **args, int arg_count){
+	unsigned int patient_id, patient_index;
+	if (arg_count != 3) return "usage: set-status <id> <visit|recover|ill|severe>";
+	if (parse_id(args[1],&patient_id)==0) return "invalid patient id";
+	patient_index = patient_index_from_id(patient_id);
+	if (patient_index == UINT_MAX) return "no patient with this id";
+
+	unsigned char status;
+	if (parse_status(args[2],&status)==0) return "unknown status";
+	patient_lock(patient_index);
+	char is_admitted = *patient_room_index_at(patient_index) != UINT_MAX;
+	if (is_admitted) patient_set_status(patient_index,status);
+	patient_unlock(patient_index);
+	if (is_admitted == 0) return "patient not currently in any room";
+	snprintf(session->detail,sizeof(session->detail),"%u %s",patient_id,PatientStatusToS[status]);
+	return NULL;
+}
+
+char* command_register_user(struct Session *session, char **args, int arg_count){
+	struct User user = {0};
+	if (arg_count != 4) return "usage: register-user <name> <password> <admin|staff>";
+	if (string_is_valid(args[1],&VALID_USERNAME)==0)
+		return "username must be 5 to 40 alphanumeric characters or underscores";
+	if (string_is_valid(args[2],&VALID_PASSWORD)==0)
+		return "password must be 8 to 40 alphanumeric characters or any of [!@#$%^&*]";
+	if (user_index_from_name(args[1]) != UINT_MAX) return "user name already in use";
+	if (strcasecmp(args[3],"admin")==0) user.privilege = ADMIN;
+	else if (strcasecmp(args[3],"staff")==0) user.privilege = STAFF;
+	else return "privilege must be admin or staff";
+	user_set_password(&user,args[2]);
+	if (string_append(args[1],&user.name)==0 || user_add(&user) == UINT_MAX) return "failed to allocate memory for the new user";
+	snprintf(session->detail,sizeof(session->detail),"%s %s",args[1],PrivsToS[user.privilege]);
+	return NULL;
+}
+
+char* command_guest(struct Session *session, char **args, int arg_count){
+	(void)args;
+	if (arg_count != 1) return "usage: guest";
+	session->user = &GUEST_USER;
+	strcpy(session->detail,"Guest");
+	return NULL;
+}
+
+char* command_view(struct Session *session, char **args, int arg_count){
+	unsigned int patient_id, patient_index;
+	if (arg_count != 2) return "usage: view <id>";
+	if (parse_id(args[1],&patient_id)==0) return "invalid patient id";
+	patient_index = patient_index_from_id(patient_id);
+	if (patient_index == UINT_MAX) return "no patient with this id";
+	struct ReadView *view = read_view_pin();
+	if (view == NULL) return "failed to pin a read view";
+	unsigned int room_index = view_patient_room_index(view,patient_index);
+	char *status = PatientStatusToS[view_patient_status(view,patient_index)];
+	read_view_unpin();
+	if (room_index == UINT_MAX)
+		snprintf(session->detail,sizeof(session->detail),"%u %s %s",patient_id,status,patient_name_at(patient_index));
+	else
+		snprintf(session->detail,sizeof(session->detail),"%u %s room %u %s",patient_id,status,
+			*room_id_at(room_index),patient_name_at(patient_index));
+	return NULL;
+}
+
+char* command_search(struct Session *session, char **args, int arg_count){
+	struct NameMatch matches[NAME_SEARCH_MAX_RESULTS];
+	char query[COMMAND_LINE_LEN] = "";
+	if (arg_count < 2) return "usage: search <name>";
+	for (int i=1; i<arg_count; i++){
+		strcat(query,args[i]);
+		strcat(query," ");
+	}
+	unsigned int match_count = name_search(query,matches,NAME_SEARCH_MAX_RESULTS);
+	int length = snprintf(session->detail,sizeof(session->detail),"%u",match_count);
+	for (unsigned int i=0; i<match_count; i++){
+		length += snprintf(session->detail+length,sizeof(session->detail)-length,"%s %u %s",i == 0 ? "" : ";",
+			*patient_id_at(matches[i].patient_index),patient_name_at(matches[i].patient_index));
+	}
+	return NULL;
+}
+
+char* command_admit_batch(struct Session *session, char **args, int arg_count){
+	struct AdmissionPlan plan;
+	unsigned int patient_indexes[COMMAND_MAX_ARGS];
+	unsigned char statuses[COMMAND_MAX_ARGS];
+	if (arg_count < 2) return "usage: admit-batch <id>[:<status>] ...";
+	for (int i=1; i<arg_count; i++){
+		unsigned int patient_id;
+		char *status = strchr(args[i],':');
+		if (status != NULL) *status++ = 0;
+		if (parse_id(args[i],&patient_id)==0) return "invalid patient id";
+		patient_indexes[i-1] = patient_index_from_id(patient_id);
+		if (patient_indexes[i-1] == UINT_MAX) return "no patient with this id";
+		if (*patient_room_index_at(patient_indexes[i-1]) != UINT_MAX) return "patient already in a room";
+		for (int j=1; j<i; j++){
+			if (patient_indexes[j-1] == patient_indexes[i-1]) return "patient listed twice";
+		}
+		statuses[i-1] = VISIT;
+		if (status != NULL && parse_status(status,&statuses[i-1])==0) return "unknown status";
+	}
+	if (admission_plan(&plan,patient_indexes,statuses,arg_count-1)==0) return "failed to allocate memory for the admission plan";
+	snprintf(session->detail,sizeof(session->detail),"%u admitted %u waiting",plan.count,plan.waiting);
+	admission_commit(&plan);
+	return NULL;
+}
+
+// count, failures and p50/p99 latency in microseconds of every operation run so far
+char* command_stats(struct Session *session, char **args, int arg_count){
+	(void)args;
+	struct OperationStats totals[OP_COUNT];
+	if (arg_count != 1) return "usage: stats";
+	stats_collect(totals);
+	int length = 0;
+	for (int i=0; i<OP_COUNT && length < (int)sizeof(session->detail); i++){
+		if (totals[i].count == 0) continue;
+		length += snprintf(session->detail+length,sizeof(session->detail)-length,"%s%s %llu %llu %.1f %.1f",
+			length == 0 ? "" : "; ",OperationToS[i],totals[i].count,totals[i].failures,
+			stats_percentile(&totals[i],50)/1e3,stats_percentile(&totals[i],99)/1e3);
+	}
+	return NULL;
+}
+
+// the patient's most recent status changes, newest first
+char* command_history(struct Session *session, char **args, int arg_count){
+	struct HistoryEvent events[HISTORY_DISPLAY_EVENTS];
+	unsigned int patient_id, patient_index;
+	char time_text[32];
+	if (arg_count != 2) return "usage: history <id>";
+	if (parse_id(args[1],&patient_id)==0) return "invalid patient id";
+	patient_index = patient_index_from_id(patient_id);
+	if (patient_index == UINT_MAX) return "no patient with this id";
+	unsigned int count = history_patient(patient_index,events,HISTORY_DISPLAY_EVENTS);
+	int length = snprintf(session->detail,sizeof(session->detail),"%u %u",patient_id,count);
+	for (unsigned int i=0; i<count && length < (int)sizeof(session->detail); i++){
+		history_time_text(events[i].time_ms,time_text,sizeof(time_text));
+		length += snprintf(session->detail+length,sizeof(session->detail)-length,"; %s %s to %s",
+			time_text,PatientStatusToS[events[i].old_status],PatientStatusToS[events[i].new_status]);
+		if (events[i].room_id != UINT_MAX && length < (int)sizeof(session->detail))
+			length += snprintf(session->detail+length,sizeof(session->detail)-length," room %u",events[i].room_id);
+	}
+	return NULL;
+}
+
+// how many patients moved into a status lately, and the most recent of them
+char* command_transitions(struct Session *session, char **args, int arg_count){
+	struct HistoryEvent recent[HISTORY_DISPLAY_EVENTS];
+	unsigned int recent_count, hours = 24;
+	unsigned char status;
+	char time_text[32];
+	if (arg_count < 2 || arg_count > 3) return "usage: transitions <status> [hours]";
+	if (strcasecmp(args[1],PatientStatusToS[DISMISSED])==0) status = DISMISSED;
+	else if (parse_status(args[1],&status)==0) return "unknown status";
+	if (arg_count == 3 && (parse_id(args[2],&hours)==0 || hours == 0)) return "invalid number of hours";
+	unsigned int count = history_transitions(status,wall_clock_ms()-hours*3600000LL,recent,HISTORY_DISPLAY_EVENTS,&recent_count);
+	int length = snprintf(session->detail,sizeof(session->detail),"%u",count);
+	for (unsigned int i=0; i<recent_count && length < (int)sizeof(session->detail); i++){
+		history_time_text(recent[i].time_ms,time_text,sizeof(time_text));
+		length += snprintf(session->detail+length,sizeof(session->detail)-length,"; %u %s from %s",
+			recent[i].patient_id,time_text,PatientStatusToS[recent[i].old_status]);
+	}
+	return NULL;
+}
+
+// every counter at once, for dashboards polling it
+char* command_census(struct Session *session, char **args, int arg_count){
+	(void)args;
+	if (arg_count != 1) return "usage: census";
+	// every number from the same view, so they add up
+	struct ReadView *view = read_view_pin();
+	if (view == NULL) return "failed to pin a read view";
+	unsigned int *by_status = view->patients_by_status;
+	snprintf(session->detail,sizeof(session->detail),
+		"visit %u recover %u ill %u severe %u dismissed %u occupied %u vacant %u reserved %u admissions %llu discharges %llu",
+		by_status[VISIT],by_status[RECOVER],by_status[ILL],by_status[SEVERE],by_status[DISMISSED],
+		view->occupied_rooms,view->vacant_rooms,view->room_count-view->occupied_rooms-view->vacant_rooms,
+		view->admissions,view->discharges);
+	read_view_unpin();
+	return NULL;
+}
+
+char* command_empty_rooms(struct Session *session, char **args, int arg_count){
+	(void)args;
+	if (arg_count != 1) return "usage: empty-rooms";
+	struct ReadView *view = read_view_pin();
+	if (view == NULL) return "failed to pin a read view";
+	if (view->first_vacant_room == UINT_MAX) strcpy(session->detail,"0");
+	else snprintf(session->detail,sizeof(session->detail),"%u first %u",view->vacant_rooms,*room_id_at(view->first_vacant_room));
+	read_view_unpin();
+	return NULL;
+}
+
+// defined prototype before declaration
+char replication_is_following();
+char* command_promote(struct Session *session, char **args, int arg_count);
+
+// commands that change data, the rest only read it
+char command_is_change(char *name){
+	return strcmp(name,"register")==0 || strcmp(name,"admit")==0 || strcmp(name,"transfer")==0
+		|| strcmp(name,"discharge")==0 || strcmp(name,"set-status")==0 || strcmp(name,"register-user")==0
+		|| strcmp(name,"admit-batch")==0;
+}
+
+// commands that add records, growing the tables and indexes every other command reads,
+// or change many patients at once, changes to a single patient only need the patient's lock
+char command_is_exclusive(char *name){
+	return strcmp(name,"register")==0 || strcmp(name,"register-user")==0 || strcmp(name,"admit-batch")==0;
+}
+
+char* command_run(struct Session *session, char **args, int arg_count){
+	char is_staff = session->user->privilege == ADMIN || session->user->privilege == STAFF;
+	session->detail[0] = 0;
+	if (strcmp(args[0],"login")==0) return command_login(session,args,arg_count);
+	if (strcmp(args[0],"guest")==0) return command_guest(session,args,arg_count);
+	// a standby only takes changes from its primary until it is promoted
+	if (command_is_change(args[0]) && replication_is_following()) return "read-only standby, promote it first";
+	if (strcmp(args[0],"empty-rooms")==0){
+		if (session->user->privilege == NOPRV) return "login required";
+		return command_empty_rooms(session,args,arg_count);
+	}
+	if (strcmp(args[0],"census")==0){
+		if (session->user->privilege == NOPRV) return "login required";
+		return command_census(session,args,arg_count);
+	}
+	if (strcmp(args[0],"view")==0){
+		if (is_staff == 0) return "staff privileges required";
+		return command_view(session,args,arg_count);
+	}
+	if (strcmp(args[0],"search")==0){
+		if (is_staff == 0) return "staff privileges required";
+		return command_search(session,args,arg_count);
+	}
+	if (strcmp(args[0],"history")==0){
+		if (is_staff == 0) return "staff privileges required";
+		return command_history(session,args,arg_count);
+	}
+	if (strcmp(args[0],"transitions")==0){
+		if (is_staff == 0) return "staff privileges required";
+		return command_transitions(session,args,arg_count);
+	}
+	if (strcmp(args[0],"admit-batch")==0){
+		if (is_staff == 0) return "staff privileges required";
+		return command_admit_batch(session,args,arg_count);
+	}
+	if (strcmp(args[0],"stats")==0){
+		if (session->user->privilege != ADMIN) return "admin privileges required";
+		return command_stats(session,args,arg_count);
+	}
+	if (strcmp(args[0],"register-user")==0){
+		if (session->user->privilege != ADMIN) return "admin privileges required";
+		return command_register_user(session,args,arg_count);
+	}
+	if (strcmp(args[0],"promote")==0){
+		if (session->user->privilege != ADMIN) return "admin privileges required";
+		return command_promote(session,args,arg_count);
+	}
+	if (strcmp(args[0],"register")==0 || strcmp(args[0],"admit")==0 || strcmp(args[0],"transfer")==0
+		|| strcmp(args[0],"discharge")==0 || strcmp(args[0],"set-status")==0){
+		if (is_staff == 0) return "staff privileges required";
+		if (args[0][0] == 'r') return command_register(session,args,arg_count);
+		if (args[0][0] == 'a') return command_move(session,args,arg_count,1);
+		if (args[0][0] == 't') return command_move(session,args,arg_count,0);
+		if (args[0][0] == 'd') return command_discharge(session,args,arg_count);
+		return command_set_status(session,args,arg_count);
+	}
+	return "unknown command";
+}
+
+// runs a command, counting it under its operation
+char* command_execute(struct Session *session, char **args, int arg_count){
+	long long start = monotonic_ns();
+	strcpy(audit_actor,string_at(session->user->name));
+	char *error = command_run(session,args,arg_count);
+	for (int i=0; i<OP_COUNT; i++){
+		if (strcmp(args[0],OperationToS[i])==0) stats_record(i,start,error != NULL);
+	}
+	return error;
+}
+
+// splits a line into whitespace separated arguments, returns how many there are
+// (COMMAND_MAX_ARGS+1 means there were too many)
+int split_command(char *line, char **args){
+	int arg_count = 0;
+	char *save;
+	char *arg = strtok_r(line," \t\r\n",&save);
+	while (arg != NULL && arg_count <= COMMAND_MAX_ARGS){
+		args[arg_count++] = arg;
+		arg = strtok_r(NULL," \t\r\n",&save);
+	}
+	return arg_count;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Batch Mode
+
+
+// Reads one command per line from a file (or stdin) and applies it straight to the
+// tables, without prompts or menus, printing one result line per command:
+//   <line number> OK <details>
+//   <line number> ERROR <reason>
+// Empty lines and lines starting with # are skipped.
+
+// returns the number of commands that failed
+unsigned int run_batch(char *path){
+	FILE *input = stdin;
+	if (path != NULL && strcmp(path,"-") != 0){
+		input = fopen(path,"r");
+		if (input == NULL){
+			out_f("Failed to open batch file %s\n",path);
+			return 1;
+		}
+	}
+	// without any admin the batch runs as the root user, same as the login menu
+	struct Session session = {.user = admin_available() ? &NOT_A_USER : &ROOT_ADMIN};
+
+	char line[COMMAND_LINE_LEN];
+	unsigned int line_number = 0, succeeded = 0, failed = 0;
+	while (fgets(line,sizeof(line),input) != NULL){
+		line_number++;
+		char *args[COMMAND_MAX_ARGS+1];
+		int arg_count = split_command(line,args);
+		if (arg_count == 0 || args[0][0] == '#') continue;
+
+		char *error = arg_count > COMMAND_MAX_ARGS ? "too many arguments" : command_execute(&session,args,arg_count);
+		if (error == NULL){
+			out_f("%u OK %s\n",line_number,session.detail);
+			succeeded++;
+		}
+		else{
+			out_f("%u ERROR %s\n",line_number,error);
+			failed++;
+		}
+		// many changes share each journal sync
+		journal_commit_if_due();
+	}
+	if (journal_commit()==0) out_s("ERROR changes could not be saved");
+	if (input != stdin) fclose(input);
+	if (output.quiet == 0) fprintf(stderr,"%u commands, %u succeeded, %u failed\n",succeeded+failed,succeeded,failed);
+	return failed;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Server
+
+
+// Serves the text commands to many clients at once, over a Unix-domain socket or a
+// TCP port on localhost. Every client has its own session and logs in with the
+// login or guest commands. Unlike the menus, the server never signs in as root,
+// so an admin has to exist first.
+// A request is a single command line, and gets a single line answer:
+//   OK <details>
+//   ERROR <reason>
+// The main thread polls every connection and hands complete requests to a pool of
+// worker threads. A client only has one request worked on at a time, so its
+// answers come back in order.
+// Registrations take the data lock alone since they grow the tables, everything
+// else shares it: admissions, transfers and discharges of different patients run
+// in parallel, claiming rooms with room_reserve. A change is only answered once its
+// journal records are on disk, sharing the sync with the changes of other clients
+// made meanwhile.
+#define SERVER_DEFAULT_SOCKET "hospital.sock"
+#define SERVER_WORKER_COUNT 4
+#define SERVER_MAX_CLIENTS 1024
+#define SERVER_SEND_TIMEOUT_S 5
+
+struct Client {
+	int fd; // -1 for a free slot
+	char busy; // owned by a worker until its buffered requests are answered
+	char closing; // the worker failed to answer, the main thread closes it
+	unsigned int buffered;
+	char buffer[COMMAND_LINE_LEN];
+	struct Session session;
+};
+
+struct {
+	int listen_fd;
+	char *socket_path; // NULL when listening on TCP
+	int wake_pipe[2]; // workers write here so poll picks up clients handed back to it
+	volatile sig_atomic_t stopping;
+	pthread_rwlock_t data_lock;
+	pthread_mutex_t queue_mutex;
+	pthread_cond_t queue_ready;
+	unsigned int queue[SERVER_MAX_CLIENTS]; // clients with a complete request, each at most once
+	unsigned int queue_head;
+	unsigned int queue_count;
+	struct Client clients[SERVER_MAX_CLIENTS];
+	pthread_t workers[SERVER_WORKER_COUNT];
+} server = {
+	.data_lock = PTHREAD_RWLOCK_INITIALIZER,
+	.queue_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.queue_ready = PTHREAD_COND_INITIALIZER,
+};
+
+void server_stop(int signal_number){
+	(void)signal_number;
+	server.stopping = 1;
+}
+
+char* server_execute(struct Session *session, char **args, int arg_count){
+	// a promotion takes the data lock itself, once the standby's last records are applied
+	if (strcmp(args[0],"promote")==0) return command_execute(session,args,arg_count);
+	if (command_is_exclusive(args[0])) pthread_rwlock_wrlock(&server.data_lock);
+	else pthread_rwlock_rdlock(&server.data_lock);
+	char *error = command_execute(session,args,arg_count);
+	unsigned long long sequence = journal_sequence();
+	pthread_rwlock_unlock(&server.data_lock);
+	if (command_is_change(args[0]) && journal_wait_durable(sequence)==0 && error == NULL) return "change could not be saved";
+	return error;
+}
+
+// answer every complete request the client has sent so far
+void server_serve_client(struct Client *client){
+	char *end;
+	while ((end = memchr(client->buffer,'\n',client->buffered)) != NULL){
+		char line[COMMAND_LINE_LEN];
+		unsigned int length = end-client->buffer;
+		memcpy(line,client->buffer,length);
+		line[length] = 0;
+		client->buffered -= length+1;
+		memmove(client->buffer,end+1,client->buffered);
+
+		char *args[COMMAND_MAX_ARGS+1];
+		char response[sizeof(client->session.detail)+16];
+		int arg_count = split_command(line,args);
+		char *error = arg_count == 0 ? "empty request"
+			: arg_count > COMMAND_MAX_ARGS ? "too many arguments"
+			: server_execute(&client->session,args,arg_count);
+		if (error == NULL) length = snprintf(response,sizeof(response),"OK %s\n",client->session.detail);
+		else length = snprintf(response,sizeof(response),"ERROR %s\n",error);
+		if (send(client->fd,response,length,MSG_NOSIGNAL) != length){
+			client->closing = 1;
+			return;
+		}
+	}
+}
+
+void* server_worker(void *unused){
+	(void)unused;
+	while (0==0){
+		pthread_mutex_lock(&server.queue_mutex);
+		while (server.queue_count == 0 && !server.stopping){
+			pthread_cond_wait(&server.queue_ready,&server.queue_mutex);
+		}
+		if (server.queue_count == 0){
+			pthread_mutex_unlock(&server.queue_mutex);
+			return NULL;
+		}
+		struct Client *client = &server.clients[server.queue[server.queue_head]];
+		server.queue_head = (server.queue_head+1)%SERVER_MAX_CLIENTS;
+		server.queue_count--;
+		pthread_mutex_unlock(&server.queue_mutex);
+
+		server_serve_client(client);
+
+		// hand the client back to the poll loop
+		pthread_mutex_lock(&server.queue_mutex);
+		client->busy = 0;
+		pthread_mutex_unlock(&server.queue_mutex);
+		if (write(server.wake_pipe[1],"",1) < 0){} // poll only needs the wake up, a full pipe is fine
+	}
+}
+
+// listens on a TCP port on localhost when given a number, otherwise on a Unix-domain socket
+char server_listen(char *address){
+	unsigned int port;
+	if (parse_id(address,&port) && port > 0 && port <= 65535){
+		struct sockaddr_in tcp_address = {.sin_family = AF_INET, .sin_port = htons(port)};
+		tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int reuse = 1;
+		server.listen_fd = socket(AF_INET,SOCK_STREAM,0);
+		if (server.listen_fd < 0) return 0;
+		setsockopt(server.listen_fd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+		if (bind(server.listen_fd,(struct sockaddr*)&tcp_address,sizeof(tcp_address)) != 0) return 0;
+	}
+	else{
+		struct sockaddr_un unix_address = {.sun_family = AF_UNIX};
+		if (strlen(address) >= sizeof(unix_address.sun_path)) return 0;
+		strcpy(unix_address.sun_path,address);
+		server.listen_fd = socket(AF_UNIX,SOCK_STREAM,0);
+		if (server.listen_fd < 0) return 0;
+		unlink(address); // left behind by a previous run
+		if (bind(server.listen_fd,(struct sockaddr*)&unix_address,sizeof(unix_address)) != 0) return 0;
+		server.socket_path = address;
+	}
+	return listen(server.listen_fd,128) == 0;
+}
+
+void server_accept(){
+	int fd = accept(server.listen_fd,NULL,NULL);
+	if (fd < 0) return;
+	for (int i=0; i<SERVER_MAX_CLIENTS; i++){
+		if (server.clients[i].fd >= 0) continue;
+		// a client that doesn't read its answers can't hold a worker forever
+		struct timeval timeout = {.tv_sec = SERVER_SEND_TIMEOUT_S};
+		setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+		server.clients[i] = (struct Client){.fd = fd, .session = {.user = &NOT_A_USER}};
+		return;
+	}
+	char full[] = "ERROR server full\n";
+	send(fd,full,sizeof(full)-1,MSG_NOSIGNAL);
+	close(fd);
+}
+
+void server_close_client(struct Client *client){
+	close(client->fd);
+	client->fd = -1;
+}
+
+// read what the client sent, queueing it for a worker once a request is complete
+void server_read_client(unsigned int client_index){
+	struct Client *client = &server.clients[client_index];
+	ssize_t result = read(client->fd,client->buffer+client->buffered,COMMAND_LINE_LEN-client->buffered);
+	if (result <= 0){
+		server_close_client(client);
+		return;
+	}
+	client->buffered += result;
+	if (memchr(client->buffer,'\n',client->buffered) == NULL){
+		if (client->buffered < COMMAND_LINE_LEN) return;
+		char too_long[] = "ERROR request too long\n";
+		send(client->fd,too_long,sizeof(too_long)-1,MSG_NOSIGNAL);
+		server_close_client(client);
+		return;
+	}
+	pthread_mutex_lock(&server.queue_mutex);
+	client->busy = 1;
+	server.queue[(server.queue_head+server.queue_count)%SERVER_MAX_CLIENTS] = client_index;
+	server.queue_count++;
+	pthread_cond_signal(&server.queue_ready);
+	pthread_mutex_unlock(&server.queue_mutex);
+}
+
+void run_server(char *address){
+	static struct pollfd poll_fds[SERVER_MAX_CLIENTS+2];
+	static unsigned int poll_clients[SERVER_MAX_CLIENTS+2];
+	for (int i=0; i<SERVER_MAX_CLIENTS; i++) server.clients[i].fd = -1;
+	if (server_listen(address)==0 || pipe(server.wake_pipe) != 0){
+		out_f("Failed to listen on %s\n",address);
+		return;
+	}
+	fcntl(server.wake_pipe[0],F_SETFL,O_NONBLOCK);
+	fcntl(server.wake_pipe[1],F_SETFL,O_NONBLOCK);
+
+	// stop cleanly on ctrl+c or a terminate signal, poll returns early when they arrive
+	struct sigaction stop_action = {.sa_handler = server_stop};
+	sigaction(SIGINT,&stop_action,NULL);
+	sigaction(SIGTERM,&stop_action,NULL);
+
+	for (int i=0; i<SERVER_WORKER_COUNT; i++){
+		pthread_create(&server.workers[i],NULL,server_worker,NULL);
+	}
+	out_f("Serving on %s with %d workers\n",address,SERVER_WORKER_COUNT);
+	out_flush();
+
+	while (!server.stopping){
+		// watch the listening socket, the wake up pipe and every client not owned by a worker
+		unsigned int poll_count = 2;
+		poll_fds[0] = (struct pollfd){.fd = server.listen_fd, .events = POLLIN};
+		poll_fds[1] = (struct pollfd){.fd = server.wake_pipe[0], .events = POLLIN};
+		pthread_mutex_lock(&server.queue_mutex);
+		for (unsigned int i=0; i<SERVER_MAX_CLIENTS; i++){
+			struct Client *client = &server.clients[i];
+			if (client->fd < 0 || client->busy) continue;
+			if (client->closing){
+				server_close_client(client);
+				continue;
+			}
+			poll_fds[poll_count] = (struct pollfd){.fd = client->fd, .events = POLLIN};
+			poll_clients[poll_count++] = i;
+		}
+		pthread_mutex_unlock(&server.queue_mutex);
+
+		if (poll(poll_fds,poll_count,-1) < 0) continue; // interrupted by a signal
+		if (poll_fds[0].revents & POLLIN) server_accept();
+		if (poll_fds[1].revents & POLLIN){
+			char drain[64];
+			while (read(server.wake_pipe[0],drain,sizeof(drain)) > 0){}
+		}
+		for (unsigned int i=2; i<poll_count; i++){
+			if (poll_fds[i].revents & (POLLIN|POLLHUP|POLLERR)) server_read_client(poll_clients[i]);
+		}
+	}
+
+	// let the workers finish what was queued, then close everything
+	pthread_mutex_lock(&server.queue_mutex);
+	pthread_cond_broadcast(&server.queue_ready);
+	pthread_mutex_unlock(&server.queue_mutex);
+	for (int i=0; i<SERVER_WORKER_COUNT; i++){
+		pthread_join(server.workers[i],NULL);
+	}
+	for (int i=0; i<SERVER_MAX_CLIENTS; i++){
+		if (server.clients[i].fd >= 0) server_close_client(&server.clients[i]);
+	}
+	close(server.listen_fd);
+	if (server.socket_path != NULL) unlink(server.socket_path);
+	out_s("Server stopped");
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Replication
+
+
+// A server started with --replicate <socket> ships its journal to standby processes on the
+// same host. A standby that connects gets a snapshot of the data file first, taken under
+// the data lock alone so it holds every change made before it, and then every journal
+// group written from then on, in order, as soon as it reaches the disk. Groups taken just
+// before the snapshot may be shipped as well; records store the resulting state, so
+// applying them again is harmless, the same as replaying the journal after a crash.
+// Each standby has its own backlog. The committer that queues a group also writes as much
+// of the backlog as the socket takes right away, so a change is normally in the standby's
+// socket before its client is answered and outlives a crash of the primary. The sender
+// thread writes out the rest without blocking the committers; a standby that falls
+// REPLICATION_MAX_BACKLOG behind is dropped. An idle
+// primary sends a heartbeat every REPLICATION_HEARTBEAT_MS, so a standby that hears nothing
+// for REPLICATION_TIMEOUT_MS knows the primary is gone.
+// A standby (hospital --standby <primary socket> [address]) runs in its own directory: it
+// saves the snapshot as its data file, serves the read-only commands to its clients and
+// applies each group under the data lock alone, as a journal replay, so readers see a
+// group whole. The promote command first lets the standby apply everything that has
+// arrived from the primary, then syncs the data file and opens it to changes, the
+// journal taking them from there.
+#define REPLICATION_MAX_STANDBYS 8
+#define REPLICATION_MAX_BACKLOG (64*1024*1024) // bytes of records queued for one standby
+#define REPLICATION_HEARTBEAT_MS 100
+#define REPLICATION_TIMEOUT_MS 1000
+#define REPLICATION_CHUNK_SIZE 65536
+
+enum ReplicationMessageType {REPLICATION_SNAPSHOT=1,REPLICATION_RECORDS,REPLICATION_HEARTBEAT};
+
+struct ReplicationMessage {
+	unsigned int type; // enum ReplicationMessageType
+	unsigned int reserved;
+	unsigned long long length; // bytes following: the data file, or a journal group
+};
+
+struct Standby {
+	int fd; // -1 for a free slot
+	unsigned char *backlog; // messages not sent yet start at sent
+	size_t used;
+	size_t sent;
+	size_t capacity;
+	unsigned long long snapshot_left; // bytes of the snapshot still in the backlog
+	long long last_send_ms;
+};
+
+struct {
+	// primary
+	int listen_fd;
+	char *socket_path;
+	int wake_pipe[2]; // the committers write here so the sender picks up new groups
+	struct Standby standbys[REPLICATION_MAX_STANDBYS];
+	pthread_mutex_t mutex;
+	pthread_t sender;
+	volatile char stopping;
+	// standby
+	int primary_fd;
+	char following; // applying the primary's records, changes from clients are refused
+	char promoting;
+	int promote_pipe[2]; // readable once a promotion asks the applier to finish
+	char *promote_socket_path; // replicates to standbys of its own once promoted, NULL when not
+	unsigned long long applied_records;
+	pthread_t applier;
+} replication = {.listen_fd = -1, .primary_fd = -1, .promote_pipe = {-1,-1}, .mutex = PTHREAD_MUTEX_INITIALIZER};
+
+void replication_drop(struct Standby *standby, char *reason){
+	out_f("Dropped a standby, %s\n",reason);
+	out_flush();
+	close(standby->fd);
+	free(standby->backlog);
+	*standby = (struct Standby){.fd = -1};
+}
+
+// adds a message to the standby's backlog, returns 0 once it has fallen too far behind
+char replication_queue(struct Standby *standby, struct ReplicationMessage *message, void *payload){
+	size_t needed = sizeof(*message)+message->length;
+	if (message->type != REPLICATION_SNAPSHOT && standby->used-standby->sent+needed > REPLICATION_MAX_BACKLOG+standby->snapshot_left) return 0;
+	// move what is left to the front before growing
+	if (standby->sent > 0){
+		memmove(standby->backlog,standby->backlog+standby->sent,standby->used-standby->sent);
+		standby->used -= standby->sent;
+		standby->sent = 0;
+	}
+	if (standby->used+needed > standby->capacity){
+		size_t capacity = standby->capacity == 0 ? REPLICATION_CHUNK_SIZE : standby->capacity;
+		while (capacity < standby->used+needed) capacity *= 2;
+		unsigned char *backlog = realloc(standby->backlog,capacity);
+		if (backlog == NULL) return 0;
+		standby->backlog = backlog;
+		standby->capacity = capacity;
+	}
+	memcpy(standby->backlog+standby->used,message,sizeof(*message));
+	if (message->length > 0) memcpy(standby->backlog+standby->used+sizeof(*message),payload,message->length);
+	standby->used += needed;
+	return 1;
+}
+
+// writes as much of the backlog as the socket takes without waiting, returns 0 if the standby is gone
+char replication_flush(struct Standby *standby, long long now_ms){
+	while (standby->sent < standby->used){
+		ssize_t result = send(standby->fd,standby->backlog+standby->sent,standby->used-standby->sent,MSG_NOSIGNAL);
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+		if (result <= 0) return 0;
+		standby->sent += result;
+		standby->snapshot_left -= standby->snapshot_left < (unsigned long long)result ? standby->snapshot_left : (unsigned long long)result;
+		standby->last_send_ms = now_ms;
+	}
+	standby->sent = standby->used = 0;
+	return 1;
+}
+
+// queues a journal group that just reached the disk for every standby, and sends what fits
+void replication_ship(unsigned char *group, unsigned int length){
+	if (replication.listen_fd < 0 || length == 0) return;
+	struct ReplicationMessage message = {.type = REPLICATION_RECORDS, .length = length};
+	long long now_ms = monotonic_ms();
+	pthread_mutex_lock(&replication.mutex);
+	for (int i=0; i<REPLICATION_MAX_STANDBYS; i++){
+		struct Standby *standby = &replication.standbys[i];
+		if (standby->fd < 0) continue;
+		if (replication_queue(standby,&message,group)==0) replication_drop(standby,"it fell too far behind");
+		else if (replication_flush(standby,now_ms)==0) replication_drop(standby,"it disconnected");
+	}
+	pthread_mutex_unlock(&replication.mutex);
+	if (write(replication.wake_pipe[1],"",1) < 0){} // a full pipe already wakes the sender
+}
+
+// a new standby starts from a snapshot of the data file, taken while no command runs
+void replication_accept(){
+	int fd = accept(replication.listen_fd,NULL,NULL);
+	if (fd < 0) return;
+	fcntl(fd,F_SETFL,O_NONBLOCK);
+	pthread_rwlock_wrlock(&server.data_lock);
+	pthread_mutex_lock(&replication.mutex);
+	struct Standby *standby = NULL;
+	for (int i=0; i<REPLICATION_MAX_STANDBYS && standby == NULL; i++){
+		if (replication.standbys[i].fd < 0) standby = &replication.standbys[i];
+	}
+	unsigned char *snapshot = NULL;
+	struct ReplicationMessage message = {.type = REPLICATION_SNAPSHOT};
+	if (standby != NULL && data_file.header != NULL){
+		// the mapping writes through the page cache, so reading the file gives the tables as they are
+		message.length = data_file.header->file_size;
+		snapshot = malloc(message.length);
+		if (snapshot != NULL && pread(data_file.fd,snapshot,message.length,0) != (ssize_t)message.length){
+			free(snapshot);
+			snapshot = NULL;
+		}
+	}
+	if (snapshot != NULL){
+		*standby = (struct Standby){.fd = fd, .snapshot_left = sizeof(message)+message.length};
+		if (replication_queue(standby,&message,snapshot)==0) replication_drop(standby,"out of memory for its snapshot");
+		else out_f("Standby connected, sending a %llu byte snapshot\n",message.length);
+	}
+	else{
+		out_s("Refused a standby, no free slot, data file or memory for its snapshot");
+		close(fd);
+	}
+	pthread_mutex_unlock(&replication.mutex);
+	pthread_rwlock_unlock(&server.data_lock);
+	free(snapshot);
+	out_flush();
+}
 
-		case 'v':
-			if (user.privilege != ADMIN && user.privilege != STAFF) break;
-			view_patient();
-			break;
-		
-		case 's':
-			if (user.privilege != ADMIN && user.privilege != STAFF) break;
-			update_patient();
-			break;
-		
-		case 't':
-			if (user.privilege != ADMIN && user.privilege != STAFF) break;
-			transfer_patient(UCHAR_MAX);
-			break;
-		
-		case 'd':
-			if (user.privilege != ADMIN && user.privilege != STAFF) break;
-			discharge_patient();
-			break;
-		
-		case 'e':
-			exit = 1;
-			break;
-		default:
+// writes out as much of every backlog as the sockets take, heartbeats for idle standbys
+void replication_send(){
+	struct ReplicationMessage heartbeat = {.type = REPLICATION_HEARTBEAT};
+	long long now_ms = monotonic_ms();
+	pthread_mutex_lock(&replication.mutex);
+	for (int i=0; i<REPLICATION_MAX_STANDBYS; i++){
+		struct Standby *standby = &replication.standbys[i];
+		if (standby->fd < 0) continue;
+		if (standby->used == standby->sent && now_ms-standby->last_send_ms >= REPLICATION_HEARTBEAT_MS)
+			replication_queue(standby,&heartbeat,NULL);
+		if (replication_flush(standby,now_ms)==0) replication_drop(standby,"it disconnected");
+	}
+	pthread_mutex_unlock(&replication.mutex);
+}
+
+void* replication_sender(void *unused){
+	(void)unused;
+	struct pollfd poll_fds[REPLICATION_MAX_STANDBYS+2];
+	while (!replication.stopping){
+		// new standbys, new groups, and standbys that can take more of their backlog
+		unsigned int poll_count = 2;
+		poll_fds[0] = (struct pollfd){.fd = replication.listen_fd, .events = POLLIN};
+		poll_fds[1] = (struct pollfd){.fd = replication.wake_pipe[0], .events = POLLIN};
+		pthread_mutex_lock(&replication.mutex);
+		for (int i=0; i<REPLICATION_MAX_STANDBYS; i++){
+			struct Standby *standby = &replication.standbys[i];
+			if (standby->fd >= 0 && standby->sent < standby->used)
+				poll_fds[poll_count++] = (struct pollfd){.fd = standby->fd, .events = POLLOUT};
+		}
+		pthread_mutex_unlock(&replication.mutex);
+
+		if (poll(poll_fds,poll_count,REPLICATION_HEARTBEAT_MS) < 0) continue;
+		if (poll_fds[0].revents & POLLIN) replication_accept();
+		if (poll_fds[1].revents & POLLIN){
+			char drain[64];
+			while (read(replication.wake_pipe[0],drain,sizeof(drain)) > 0){}
+		}
+		replication_send();
+	}
+	return NULL;
+}
+
+// listens for standbys on a Unix-domain socket
+char replication_start(char *path){
+	struct sockaddr_un unix_address = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(unix_address.sun_path)) return 0;
+	strcpy(unix_address.sun_path,path);
+	for (int i=0; i<REPLICATION_MAX_STANDBYS; i++) replication.standbys[i].fd = -1;
+	int fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if (fd < 0) return 0;
+	unlink(path); // left behind by a previous run
+	if (bind(fd,(struct sockaddr*)&unix_address,sizeof(unix_address)) != 0 || listen(fd,REPLICATION_MAX_STANDBYS) != 0
+		|| pipe(replication.wake_pipe) != 0){
+		close(fd);
+		return 0;
+	}
+	fcntl(replication.wake_pipe[0],F_SETFL,O_NONBLOCK);
+	fcntl(replication.wake_pipe[1],F_SETFL,O_NONBLOCK);
+	replication.socket_path = path;
+	replication.listen_fd = fd;
+	if (pthread_create(&replication.sender,NULL,replication_sender,NULL) != 0){
+		close(fd);
+		replication.listen_fd = -1;
+		return 0;
+	}
+	out_f("Replicating to standbys on %s\n",path);
+	return 1;
+}
+
+// reads exactly length bytes from the primary, 0 once it closed or went quiet for too long,
+// or once a promotion is waiting and nothing more has arrived
+char replication_read(void *buffer, size_t length){
+	size_t done = 0;
+	while (done < length){
+		struct pollfd poll_fds[2] = {{.fd = replication.primary_fd, .events = POLLIN},{.fd = replication.promote_pipe[0], .events = POLLIN}};
+		int ready = poll(poll_fds,2,REPLICATION_TIMEOUT_MS);
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready <= 0 || poll_fds[0].revents == 0) return 0;
+		ssize_t result = read(replication.primary_fd,(char*)buffer+done,length-done);
+		if (result <= 0) return 0;
+		done += result;
+	}
+	return 1;
+}
+
+void* replication_applier(void *unused){
+	(void)unused;
+	static unsigned char group[JOURNAL_BUFFER_SIZE];
+	struct ReplicationMessage message;
+	while (replication_read(&message,sizeof(message))){
+		if (message.type == REPLICATION_HEARTBEAT && message.length == 0) continue;
+		if (message.type != REPLICATION_RECORDS || message.length > JOURNAL_BUFFER_SIZE || replication_read(group,message.length)==0) break;
+		// a group at a time, so readers see all of it or none of it
+		unsigned int applied = 0;
+		pthread_rwlock_wrlock(&server.data_lock);
+		unsigned int used = journal_apply_buffer(group,message.length,&applied);
+		replication.applied_records += applied;
+		pthread_rwlock_unlock(&server.data_lock);
+		history_flush();
+		if (used != message.length){
+			out_s("The primary sent a damaged journal group, no longer following it");
 			break;
 		}
 	}
+	if (replication.promoting == 0){
+		out_s("Lost the primary, serving reads until promoted");
+		out_flush();
+	}
+	return NULL;
 }
 
-struct User login_attempt(){
-	// Get login details
-	// Note: taking all details at once to make security better
-	char name[STRING_MAX_LEN];
-	char password[STRING_MAX_LEN];
-	title("sign-in menu");
-	puts("Please enter login information:");
-	puts("Username:");
-	prompt_s(name);
-	puts("Password:");
-	prompt_s(password);
-	puts(S_SEPARATOR);
-	// loop over all available users
-	for (int i=0; i<user_count; i++){
-		// only login if both name and password are correct
-		if (strcmp(users[i].name, name)==0 & strcmp(users[i].password, password)==0){
-			printf("Succesfully logged in as %s\n",name);
-			prompt_c();
-			// return current user for further actions
-			return users[i];
+// defined prototype before declaration
+enum DataFileState load_data();
+
+// connects to the primary, saves its snapshot as the data file and loads it, then follows it
+char standby_start(char *primary_path, char *promote_socket_path){
+	static unsigned char chunk[REPLICATION_CHUNK_SIZE];
+	struct sockaddr_un unix_address = {.sun_family = AF_UNIX};
+	struct ReplicationMessage message;
+	if (strlen(primary_path) >= sizeof(unix_address.sun_path)) return 0;
+	strcpy(unix_address.sun_path,primary_path);
+	replication.primary_fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if (replication.primary_fd < 0 || connect(replication.primary_fd,(struct sockaddr*)&unix_address,sizeof(unix_address)) != 0){
+		out_f("Failed to connect to the primary on %s\n",primary_path);
+		return 0;
+	}
+	if (pipe(replication.promote_pipe) != 0) return 0;
+	if (replication_read(&message,sizeof(message))==0 || message.type != REPLICATION_SNAPSHOT){
+		out_s("The primary sent no snapshot");
+		return 0;
+	}
+
+	// the snapshot replaces this directory's data, a journal or history left here is stale
+	int fd = open(DATA_FILE_PATH,O_WRONLY|O_CREAT|O_TRUNC,0600);
+	if (fd < 0) return 0;
+	for (unsigned long long left=message.length; left>0;){
+		size_t length = left < sizeof(chunk) ? left : sizeof(chunk);
+		if (replication_read(chunk,length)==0 || write(fd,chunk,length) != (ssize_t)length){
+			out_s("Failed to receive the snapshot");
+			close(fd);
+			return 0;
 		}
+		left -= length;
 	}
-	// don't provide exact information about reason for refusal for security reasons
-	printf("Failed to login as %s. Either the username or password is wrong\n",name);
-	prompt_c();
-	return NOT_A_USER;
+	close(fd);
+	unlink(JOURNAL_FILE_PATH);
+	unlink(HISTORY_FILE_PATH);
+	unlink(HISTORY_OPEN_FILE_PATH);
+	if (load_data() != DATA_FILE_LOADED){
+		out_s("The snapshot from the primary is damaged");
+		return 0;
+	}
+
+	// applied records are the primary's, they aren't journaled or audited again here
+	journal.replaying = 1;
+	replication.following = 1;
+	replication.promote_socket_path = promote_socket_path;
+	if (pthread_create(&replication.applier,NULL,replication_applier,NULL) != 0) return 0;
+	out_f("Following the primary on %s\n",primary_path);
+	return 1;
 }
 
-// Login loop to allow multiple login attempts
-struct User login_loop(){
-	struct User user = NOT_A_USER;
-	char action;
-	char exit = 0;
-	char admin_available = 0;
+char replication_is_following(){
+	return replication.following;
+}
 
-	// check if an admin is availble
-	for (int i=0; i<user_count; i++){
-		if (users[i].privilege == ADMIN){
-			admin_available=1;
-			break;
+// turns a standby into a primary, run without the data lock since the applier needs it
+// to apply what is still on its way from the primary
+char* command_promote(struct Session *session, char **args, int arg_count){
+	(void)args;
+	if (arg_count != 1) return "usage: promote";
+	if (replication.following == 0) return "not a standby";
+	if (__atomic_exchange_n(&replication.promoting,1,__ATOMIC_ACQ_REL)) return "already being promoted";
+	long long start = monotonic_ns();
+	if (write(replication.promote_pipe[1],"",1) < 0){}
+	pthread_join(replication.applier,NULL);
+	pthread_rwlock_wrlock(&server.data_lock);
+	journal.replaying = 0;
+	// what was taken over is on disk before the first change is journaled
+	journal_checkpoint();
+	replication.following = 0;
+	pthread_rwlock_unlock(&server.data_lock);
+	if (replication.promote_socket_path != NULL && replication_start(replication.promote_socket_path)==0)
+		out_f("Failed to replicate on %s\n",replication.promote_socket_path);
+	out_flush();
+	snprintf(session->detail,sizeof(session->detail),"primary after %llu records in %.1f ms",
+		replication.applied_records,(monotonic_ns()-start)/1e6);
+	return NULL;
+}
+
+// stops following the primary, or shipping to the standbys
+void replication_stop(){
+	if (replication.primary_fd >= 0){
+		// the applier was joined by a promotion already, or stops at its next read
+		if (__atomic_exchange_n(&replication.promoting,1,__ATOMIC_ACQ_REL) == 0){
+			shutdown(replication.primary_fd,SHUT_RDWR);
+			pthread_join(replication.applier,NULL);
+		}
+		close(replication.primary_fd);
+		replication.primary_fd = -1;
+	}
+	if (replication.listen_fd >= 0){
+		replication.stopping = 1;
+		pthread_join(replication.sender,NULL);
+		// what was already committed still goes out, as far as the sockets take it right away
+		replication_send();
+		for (int i=0; i<REPLICATION_MAX_STANDBYS; i++){
+			if (replication.standbys[i].fd >= 0){
+				close(replication.standbys[i].fd);
+				free(replication.standbys[i].backlog);
+				replication.standbys[i] = (struct Standby){.fd = -1};
+			}
 		}
+		close(replication.listen_fd);
+		replication.listen_fd = -1;
+		unlink(replication.socket_path);
 	}
+}
 
-	if (admin_available ==0){
-		title("login menu");
-		puts("No admins currently available, signing in as root user");
-		puts("Please setup an Admin as soon as possible to avoid security risks and allow regular logins");
-		prompt_c();
-		return ROOT_ADMIN;
+
+//------------------------------------------------------------------------------------------------------
+// Bulk Import
+
+
+// Imports rooms, patients or users from a comma or tab separated file:
+//   rooms:    <room id>
+//   patients: <patient id>,<first name>,<last name>
+//   users:    <username>,<password>,<admin|staff>
+// The file is read in fixed-size chunks, so it never has to fit in memory.
+// Fields follow the same rules as the menus. Rows go straight into the tables
+// and the id indexes are built once after the last row. Rows with a duplicate id
+// are dropped at that point. The data file is synced once at the end instead of
+// journaling every row.
+// A first line starting with "id" or "name" is taken as a header and skipped.
+#define IMPORT_CHUNK_SIZE 65536
+#define IMPORT_MAX_FIELDS 3
+
+enum ImportKind {IMPORT_ROOMS,IMPORT_PATIENTS,IMPORT_USERS};
+char ImportKindToS[3][20] = {"rooms","patients","users"};
+
+struct {
+	enum ImportKind kind;
+	char delimiter;
+	unsigned int line_number;
+	unsigned int first_index; // first table index written by this import
+	unsigned int *line_numbers; // source line of every imported row, for reporting duplicates
+	unsigned int line_numbers_capacity;
+	unsigned int rejected;
+} import;
+
+void import_reject(unsigned int line_number, char *reason){
+	out_f("%u ERROR %s\n",line_number,reason);
+	import.rejected++;
+}
+
+// remember which line a row came from, returns 0 without memory
+char import_track_line(unsigned int row){
+	if (row >= import.line_numbers_capacity){
+		unsigned int capacity = import.line_numbers_capacity == 0 ? 4096 : import.line_numbers_capacity*2;
+		unsigned int *line_numbers = realloc(import.line_numbers,sizeof(unsigned int)*capacity);
+		if (line_numbers == NULL) return 0;
+		import.line_numbers = line_numbers;
+		import.line_numbers_capacity = capacity;
 	}
-	
-	while (user.privilege == NOPRV && exit == 0){
-		title("login menu");
-		puts("Welcome to Hospital Staff Login, what would you like to do?");
-		puts("(G) Login as a Guest");
-		puts("(U) Login as a User");
-		puts("(E) Exit");
-		puts("");
-		switch (tolower(prompt_c()))
-		{
-		case 'g':
-			puts("Succesfully logged in as a guest account");
-			user = GUEST_USER;
-			break;
-		
-		case 'u':
-			user = login_attempt();
+	import.line_numbers[row] = import.line_number;
+	return 1;
+}
+
+// appends a record for one row, returns NULL on success or the reason it was rejected
+char* import_row(char **fields, int field_count){
+	unsigned int id, index;
+	switch (import.kind)
+	{
+	case IMPORT_ROOMS:
+		if (field_count != 1) return "expected <room id>";
+		// UINT_MAX stands for no room in the audit trail
+		if (parse_id(fields[0],&id)==0 || id == UINT_MAX) return "invalid room id";
+		index = table_append(&rooms);
+		if (index == UINT_MAX) return "failed to allocate memory for the room";
+		if (import_track_line(index-import.first_index)==0){
+			rooms.count--;
+			return "failed to allocate memory for the room";
+		}
+		*room_id_at(index) = id;
+		*room_status_at(index) = VACANT;
+		return NULL;
+
+	case IMPORT_PATIENTS:
+		if (field_count != 3) return "expected <patient id>,<first name>,<last name>";
+		if (parse_id(fields[0],&id)==0) return "invalid patient id";
+		for (int i=1; i<3; i++){
+			if (string_is_valid(fields[i],&VALID_PATIENT)==0)
+				return "names must be 1 to 20 alphabetic characters";
+		}
+		char name[STRING_MAX_LEN];
+		struct StringRef name_ref;
+		snprintf(name,sizeof(name),"%s %s",fields[1],fields[2]);
+		if (string_intern(name,&name_ref)==0) return "failed to allocate memory for the patient name";
+		index = table_append(&patients);
+		if (index == UINT_MAX) return "failed to allocate memory for the patient";
+		if (import_track_line(index-import.first_index)==0){
+			patients.count--;
+			return "failed to allocate memory for the patient";
+		}
+		*patient_id_at(index) = id;
+		*patient_name_ref_at(index) = name_ref;
+		*patient_status_at(index) = DISMISSED;
+		*patient_room_index_at(index) = UINT_MAX;
+		return NULL;
+
+	case IMPORT_USERS:{
+		struct User user = {0};
+		if (field_count != 3) return "expected <username>,<password>,<admin|staff>";
+		if (string_is_valid(fields[0],&VALID_USERNAME)==0)
+			return "username must be 5 to 40 alphanumeric characters or underscores";
+		if (string_is_valid(fields[1],&VALID_PASSWORD)==0)
+			return "password must be 8 to 40 alphanumeric characters or any of [!@#$%^&*]";
+		if (strcasecmp(fields[2],"admin")==0) user.privilege = ADMIN;
+		else if (strcasecmp(fields[2],"staff")==0) user.privilege = STAFF;
+		else return "privilege must be admin or staff";
+		if (user_index_from_name(fields[0]) != UINT_MAX) return "user name already in use";
+		user_set_password(&user,fields[1]);
+		if (string_append(fields[0],&user.name)==0) return "failed to allocate memory for the user name";
+		index = table_append(&users);
+		if (index == UINT_MAX) return "failed to allocate memory for the user";
+		*user_at(index) = user;
+		if (user_directory_add(index)==0){
+			users.count--;
+			data_file_sync_count(&users);
+			return "failed to allocate memory for the user directory";
+		}
+		return NULL;
+	}
+	}
+	return "unknown import";
+}
+
+void import_line(char *line){
+	import.line_number++;
+	if (line[0] == 0) return;
+	// pick the delimiter from the first line
+	if (import.line_number == 1){
+		import.delimiter = strchr(line,'\t') != NULL ? '\t' : ',';
+		if (strncasecmp(line,"id",2)==0 || strncasecmp(line,"name",4)==0) return;
+	}
+
+	char *fields[IMPORT_MAX_FIELDS];
+	int field_count = 0;
+	char *field = line;
+	while (field != NULL){
+		if (field_count == IMPORT_MAX_FIELDS){
+			import_reject(import.line_number,"too many fields");
+			return;
+		}
+		fields[field_count++] = field;
+		field = strchr(field,import.delimiter);
+		if (field != NULL) *field++ = 0;
+	}
+	char *error = import_row(fields,field_count);
+	if (error != NULL) import_reject(import.line_number,error);
+}
+
+// one pass over the imported patients: drop duplicate ids and index the rest
+void import_finish_patients(){
+	if (patient_id_index_reserve(patients.count)==0) return;
+	unsigned int write_index = import.first_index;
+	for (unsigned int read_index=import.first_index; read_index<patients.count; read_index++){
+		if (patient_index_from_id(*patient_id_at(read_index)) != UINT_MAX){
+			import_reject(import.line_numbers[read_index-import.first_index],"duplicate patient id");
+			continue;
+		}
+		if (write_index != read_index) table_copy_record(&patients,write_index,read_index);
+		patient_id_index_insert(*patient_id_at(write_index),write_index);
+		name_index_add(write_index);
+		write_index++;
+	}
+	patients.count = write_index;
+	data_file_sync_count(&patients);
+}
+
+// drop the imported rooms whose id is taken, by a room from before or an earlier row,
+// then build the wards once
+void import_finish_rooms(){
+	unsigned int count = rooms.count-import.first_index;
+	// the imported rows sorted by id, the earlier row first for a repeated id
+	unsigned long long *rows = malloc(sizeof(unsigned long long)*(count+1));
+	char *rejected = calloc(count+1,1);
+	if (rows == NULL || rejected == NULL){
+		out_s("Failed to allocate memory for the imported rooms");
+		rooms.count = import.first_index;
+		data_file_sync_count(&rooms);
+		free(rows);
+		free(rejected);
+		return;
+	}
+	for (unsigned int row=0; row<count; row++) rows[row] = (unsigned long long)*room_id_at(import.first_index+row) << 32 | row;
+	qsort(rows,count,sizeof(unsigned long long),compare_unsigned_long_long);
+	for (unsigned int i=0; i<count; i++){
+		unsigned int row = (unsigned int)rows[i];
+		if (room_index_from_id(rows[i] >> 32) != UINT_MAX || (i > 0 && rows[i-1] >> 32 == rows[i] >> 32)) rejected[row] = 1;
+	}
+	unsigned int write_index = import.first_index;
+	for (unsigned int row=0; row<count; row++){
+		if (rejected[row]){
+			import_reject(import.line_numbers[row],"duplicate room id");
+			continue;
+		}
+		if (write_index != import.first_index+row) table_copy_record(&rooms,write_index,import.first_index+row);
+		write_index++;
+	}
+	rooms.count = write_index;
+	data_file_sync_count(&rooms);
+	free(rows);
+	free(rejected);
+	room_indexes_rebuild();
+}
+
+// returns the number of rejected rows
+unsigned int import_file(enum ImportKind kind, char *path){
+	int fd = open(path,O_RDONLY);
+	if (fd < 0){
+		out_f("Failed to open import file %s\n",path);
+		return 1;
+	}
+	struct Table *tables[3] = {&rooms,&patients,&users};
+	memset(&import,0,sizeof(import));
+	import.kind = kind;
+	import.first_index = tables[kind]->count;
+
+	static char buffer[IMPORT_CHUNK_SIZE+1];
+	unsigned int buffered = 0;
+	while (0==0){
+		ssize_t result = read(fd,buffer+buffered,IMPORT_CHUNK_SIZE-buffered);
+		if (result < 0){
+			out_s("Failed to read the import file");
 			break;
-		
-		case 'e':
-			exit = 1;
+		}
+		buffered += result;
+
+		// hand every complete line to the parser
+		unsigned int position = 0;
+		while (position < buffered){
+			char *end = memchr(buffer+position,'\n',buffered-position);
+			if (end == NULL) break;
+			*end = 0;
+			if (end > buffer+position && end[-1] == '\r') end[-1] = 0;
+			import_line(buffer+position);
+			position = end-buffer+1;
+		}
+		// keep the partial line for the next chunk
+		memmove(buffer,buffer+position,buffered-position);
+		buffered -= position;
+
+		if (result == 0){
+			// last line without a line break
+			if (buffered > 0){
+				buffer[buffered] = 0;
+				import_line(buffer);
+			}
 			break;
-		
-		default:
+		}
+		if (buffered == IMPORT_CHUNK_SIZE){
+			import_reject(import.line_number+1,"line too long");
 			break;
 		}
 	}
-	return user;
+	close(fd);
+
+	// build the indexes once for the whole import
+	if (kind == IMPORT_PATIENTS) import_finish_patients();
+	if (kind == IMPORT_ROOMS) import_finish_rooms();
+	census_rebuild();
+	free(import.line_numbers);
+	// everything imported is in the data file now, sync it instead of journaling each row
+	journal_checkpoint();
+
+	out_f("Imported %u %s, %u rows rejected\n",tables[kind]->count-import.first_index,ImportKindToS[kind],import.rejected);
+	return import.rejected;
+}
+
+
+//------------------------------------------------------------------------------------------------------
+// Benchmarks
+
+
+// Builds a deterministic dataset of N rooms, patients and users in memory (no data
+// file or journal) for every power of ten up to the requested size, and times the
+// lookups and changes the menus rely on. Operations are timed in groups of
+// BENCH_GROUP_OPS, so the clock's own cost doesn't swamp the short operations,
+// and the p50/p99 latencies are of the per operation time within each group.
+#define BENCH_GROUP_OPS 16
+#define BENCH_MAX_OPS 1000000
+#define BENCH_TIME_LIMIT_MS 1000
+#define BENCH_DEFAULT_MAX_RECORDS 10000000
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_PASSWORD "password1" // every generated user's password
+#define BENCH_HISTORY_DAYS 30 // the generated status history goes back this far, one change per patient
+
+unsigned long long bench_random_state;
+unsigned int bench_admitted_count; // patients [0,bench_admitted_count) start out in rooms
+volatile unsigned int bench_sink; // results are stored here so the work isn't optimized out
+
+// splitmix64, small and deterministic for a given seed
+unsigned long long bench_random(){
+	unsigned long long z = (bench_random_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+unsigned int bench_random_below(unsigned int limit){
+	return bench_random() % limit;
+}
+
+// hash_id is a bijection, so every index gets a different patient id
+unsigned int bench_patient_id(unsigned int index){
+	return hash_id(index ^ 0x5bd1e995u);
+}
+
+void bench_user_name(unsigned int index, char *name){
+	snprintf(name,STRING_MAX_LEN,"user_%08u",index);
+}
+
+// a first name of two syllables and a last name of three, picked by the bits of the index's hash
+char *BENCH_SYLLABLES[] = {"an","bel","cor","da","el","fin","gar","hal","is","jo","ka","lin","mar",
+	"nor","os","pe","qui","ros","sa","tor","ul","ver","wil","xa","yo","zen","ber","cha","dun","ev","li","mo"};
+void bench_patient_name(unsigned int index, char *name){
+	unsigned int bits = hash_id(index ^ 0x9747b28cu);
+	char *c = name;
+	for (int i=0; i<5; i++){
+		if (i == 2) *c++ = ' ';
+		char *syllable = BENCH_SYLLABLES[(bits >> (i*5)) & 31];
+		if (i == 0 || i == 2) *c++ = toupper(*syllable++);
+		while (*syllable) *c++ = *syllable++;
+	}
+	*c = 0;
+}
+
+// fills the tables with count rooms, patients and users, half of the patients in random rooms
+// every user shares one salt and hash, hashing millions of passwords would dwarf the benchmarks
+char generate_dataset(unsigned long long seed, unsigned int count){
+	struct User user_template = {.privilege = STAFF};
+	bench_random_state = seed;
+	table_clear(&rooms);
+	table_clear(&patients);
+	table_clear(&users);
+	string_arena_clear();
+	for (int i=0; i<USER_SALT_LEN; i++) user_template.salt[i] = bench_random();
+	password_hash(user_template.salt,BENCH_PASSWORD,user_template.password_hash);
+	char name[STRING_MAX_LEN];
+
+	for (unsigned int i=0; i<count; i++){
+		unsigned int room_index = table_append(&rooms);
+		unsigned int patient_index = table_append(&patients);
+		unsigned int user_index = table_append(&users);
+		if (room_index == UINT_MAX || patient_index == UINT_MAX || user_index == UINT_MAX) return 0;
+
+		*room_id_at(room_index) = i; // ROOM_WARD_SPAN rooms to a ward
+		*room_status_at(room_index) = VACANT;
+
+		*patient_id_at(patient_index) = bench_patient_id(i);
+		bench_patient_name(i,name);
+		if (string_intern(name,patient_name_ref_at(patient_index))==0) return 0;
+		*patient_status_at(patient_index) = DISMISSED;
+		*patient_room_index_at(patient_index) = UINT_MAX;
+
+		struct User *user = user_at(user_index);
+		*user = user_template;
+		bench_user_name(i,name);
+		if (string_append(name,&user->name)==0) return 0;
+	}
+
+	// shuffle the room order, then place the first half of the patients
+	unsigned int *room_order = malloc(sizeof(unsigned int)*count);
+	if (room_order == NULL) return 0;
+	for (unsigned int i=0; i<count; i++) room_order[i] = i;
+	for (unsigned int i=count; i>1; i--){
+		unsigned int j = bench_random_below(i);
+		unsigned int swap = room_order[i-1];
+		room_order[i-1] = room_order[j];
+		room_order[j] = swap;
+	}
+	bench_admitted_count = count/2;
+	for (unsigned int i=0; i<bench_admitted_count; i++){
+		*room_patient_id_at(room_order[i]) = *patient_id_at(i);
+		*room_status_at(room_order[i]) = FULL;
+		*patient_room_index_at(i) = room_order[i];
+		*patient_status_at(i) = bench_random_below(DISMISSED);
+	}
+	free(room_order);
+
+	room_indexes_rebuild();
+	census_rebuild();
+	if (patient_id_index_rebuild()==0 || name_index_rebuild()==0 || user_directory_rebuild()==0) return 0;
+
+	// a status change of a random patient every so often over the last BENCH_HISTORY_DAYS,
+	// kept in memory only, and changes made by the benchmarks are added to it
+	history_clear();
+	history.running = 1;
+	long long now_ms = wall_clock_ms();
+	long long span_ms = BENCH_HISTORY_DAYS*86400000LL;
+	for (unsigned int i=0; i<count; i++){
+		unsigned int patient_index = bench_random_below(count);
+		struct HistoryEvent event = {.time_ms = now_ms-span_ms+span_ms*i/count, .patient_id = *patient_id_at(patient_index),
+			.room_id = bench_random_below(count), .old_status = bench_random_below(DISMISSED+1)};
+		event.new_status = (event.old_status+1+bench_random_below(DISMISSED))%(DISMISSED+1);
+		if (history_add(patient_index,&event)==0) return 0;
+	}
+	return 1;
+}
+
+// Benchmarked operations, one call is one operation
+void bench_patient_index_from_id(){
+	bench_sink = patient_index_from_id(bench_patient_id(bench_random_below(patients.count)));
+}
+
+void bench_patient_room_index_from_id(){
+	bench_sink = patient_room_index_from_id(bench_patient_id(bench_random_below(patients.count)));
+}
+
+void bench_user_index_from_name(){
+	char name[STRING_MAX_LEN];
+	bench_user_name(bench_random_below(users.count),name);
+	bench_sink = user_index_from_name(name);
+}
+
+// the check every imported or batch username goes through
+void bench_validate_name(){
+	char name[STRING_MAX_LEN];
+	bench_user_name(bench_random_below(users.count),name);
+	bench_sink = string_is_valid(name,&VALID_USERNAME);
+}
+
+void bench_login(){
+	char name[STRING_MAX_LEN];
+	bench_user_name(bench_random_below(users.count),name);
+	bench_sink = user_index_from_login(name,BENCH_PASSWORD);
+}
+
+// a full scan of the patient status and room status columns
+void bench_status_scan(){
+	unsigned int counts[DISMISSED+1];
+	patient_status_counts(counts);
+	bench_sink = counts[bench_random_below(DISMISSED+1)] + occupied_room_count();
 }
+
+// the query behind check_empty_rooms, without the console output
+void bench_check_empty_rooms(){
+	bench_sink = vacant_room_total() + first_vacant_room();
+}
+
+// the start of a random patient's last name
+void bench_name_search_prefix(){
+	struct NameMatch matches[NAME_SEARCH_MAX_RESULTS];
+	char name[STRING_MAX_LEN];
+	bench_patient_name(bench_random_below(patients.count),name);
+	char *last_name = strchr(name,' ')+1;
+	last_name[4] = 0;
+	bench_sink = name_search(last_name,matches,NAME_SEARCH_MAX_RESULTS);
+}
+
+// a random patient's full name with one letter of the last name mistyped
+void bench_name_search_typo(){
+	struct NameMatch matches[NAME_SEARCH_MAX_RESULTS];
+	char name[STRING_MAX_LEN];
+	bench_patient_name(bench_random_below(patients.count),name);
+	char *last_name = strchr(name,' ')+1;
+	last_name[bench_random_below(strlen(last_name))] = 'a'+bench_random_below(26);
+	bench_sink = name_search(name,matches,NAME_SEARCH_MAX_RESULTS);
+}
+
+// moves an admitted patient to a vacant room in a random ward
+void bench_transfer(){
+	unsigned int patient_index = bench_random_below(bench_admitted_count);
+	unsigned int room_index = room_reserve_vacant(bench_random_below(ward_count));
+	if (room_index != UINT_MAX) patient_move(patient_index,room_index);
+}
+
+// a transfer and then a reader pinning a view, which has to copy the slabs the transfer wrote
+void bench_view_after_transfer(){
+	bench_transfer();
+	struct ReadView *view = read_view_pin();
+	if (view == NULL) return;
+	bench_sink = view->occupied_rooms + view_patient_room_index(view,bench_random_below(view->patient_count));
+	read_view_unpin();
+}
+
+// discharges the admitted patients one after another
+unsigned int bench_discharge_next;
+void bench_discharge(){
+	if (bench_discharge_next >= bench_admitted_count) return;
+	patient_move_with_status(bench_discharge_next,UINT_MAX,DISMISSED);
+	bench_discharge_next++;
+}
+
+// triages the next batch of never admitted patients and admits them all at once,
+// run after the discharges so there are rooms for all of them
+#define BENCH_ADMISSION_BATCH 100
+unsigned int bench_admission_next;
+void bench_admit_batch(){
+	unsigned int patient_indexes[BENCH_ADMISSION_BATCH];
+	unsigned char statuses[BENCH_ADMISSION_BATCH];
+	struct AdmissionPlan plan;
+	if (bench_admission_next+BENCH_ADMISSION_BATCH > patients.count) return;
+	for (unsigned int i=0; i<BENCH_ADMISSION_BATCH; i++){
+		patient_indexes[i] = bench_admission_next++;
+		statuses[i] = bench_random_below(DISMISSED);
+	}
+	if (admission_plan(&plan,patient_indexes,statuses,BENCH_ADMISSION_BATCH)) admission_commit(&plan);
+}
+
+// a random patient's most recent status changes, following the chain back through the blocks
+void bench_history_patient(){
+	struct HistoryEvent events[HISTORY_DISPLAY_EVENTS];
+	bench_sink = history_patient(bench_random_below(patients.count),events,HISTORY_DISPLAY_EVENTS);
+}
+
+// every move into severe over the last day, the blocks before it are never read
+void bench_transitions_24h(){
+	struct HistoryEvent recent[HISTORY_DISPLAY_EVENTS];
+	unsigned int recent_count;
+	bench_sink = history_transitions(SEVERE,wall_clock_ms()-86400000LL,recent,HISTORY_DISPLAY_EVENTS,&recent_count);
+}
+
+// every move into severe ever, a scan of the whole history
+void bench_transitions_all(){
+	struct HistoryEvent recent[HISTORY_DISPLAY_EVENTS];
+	unsigned int recent_count;
+	bench_sink = history_transitions(SEVERE,0,recent,HISTORY_DISPLAY_EVENTS,&recent_count);
+}
+
+int compare_long_long(const void *a, const void *b){
+	long long difference = *(long long*)a - *(long long*)b;
+	return (difference > 0) - (difference < 0);
+}
+
+void bench_run(char *name, unsigned int records, void (*operation)(), unsigned int max_ops){
+	static long long samples[BENCH_MAX_OPS/BENCH_GROUP_OPS];
+	unsigned int sample_count = 0;
+	long long start = monotonic_ns();
+	long long deadline = start + BENCH_TIME_LIMIT_MS*1000000LL;
+	long long total = 0;
+	unsigned int group_count = max_ops/BENCH_GROUP_OPS;
+	if (group_count > BENCH_MAX_OPS/BENCH_GROUP_OPS) group_count = BENCH_MAX_OPS/BENCH_GROUP_OPS;
+	if (group_count == 0) group_count = 1;
+
+	while (sample_count < group_count){
+		long long group_start = monotonic_ns();
+		for (int i=0; i<BENCH_GROUP_OPS; i++) operation();
+		long long group_end = monotonic_ns();
+		samples[sample_count++] = (group_end-group_start)/BENCH_GROUP_OPS;
+		total += group_end-group_start;
+		if (group_end > deadline) break;
+	}
+	qsort(samples,sample_count,sizeof(long long),compare_long_long);
+	unsigned int ops = sample_count*BENCH_GROUP_OPS;
+	out_f("%-10u %-28s %10u %14.0f %10lld %10lld\n",records,name,ops,
+		total > 0 ? ops*1e9/total : 0.0,samples[sample_count/2],samples[sample_count*99/100]);
+}
+
+void run_benchmarks(unsigned int max_records, unsigned long long seed){
+	out_f("%-10s %-28s %10s %14s %10s %10s\n","records","operation","ops","ops/sec","p50 ns","p99 ns");
+	for (unsigned int records=100; records<=max_records; records*=10){
+		if (generate_dataset(seed,records)==0){
+			out_f("Failed to allocate memory for %u records\n",records);
+			return;
+		}
+		bench_random_state = seed;
+		bench_run("patient_index_from_id",records,bench_patient_index_from_id,BENCH_MAX_OPS);
+		bench_run("patient_room_index_from_id",records,bench_patient_room_index_from_id,BENCH_MAX_OPS);
+		bench_run("user_index_from_name",records,bench_user_index_from_name,BENCH_MAX_OPS);
+		bench_run("login",records,bench_login,BENCH_MAX_OPS);
+		bench_run("validate_name",records,bench_validate_name,BENCH_MAX_OPS);
+		bench_run("name_search_prefix",records,bench_name_search_prefix,BENCH_MAX_OPS);
+		bench_run("name_search_typo",records,bench_name_search_typo,BENCH_MAX_OPS);
+		bench_run("check_empty_rooms",records,bench_check_empty_rooms,BENCH_MAX_OPS);
+		bench_run("status_scan",records,bench_status_scan,BENCH_MAX_OPS);
+		bench_run("transfer",records,bench_transfer,BENCH_MAX_OPS);
+		bench_run("view_after_transfer",records,bench_view_after_transfer,BENCH_MAX_OPS);
+		bench_run("history_patient",records,bench_history_patient,BENCH_MAX_OPS);
+		bench_run("transitions_24h",records,bench_transitions_24h,BENCH_MAX_OPS);
+		bench_run("transitions_all",records,bench_transitions_all,BENCH_MAX_OPS);
+		bench_discharge_next = 0;
+		bench_run("discharge",records,bench_discharge,bench_admitted_count);
+		bench_admission_next = bench_admitted_count;
+		bench_run("admit_batch_100",records,bench_admit_batch,(records-bench_admitted_count)/BENCH_ADMISSION_BATCH);
+		out_flush();
+		if (records > UINT_MAX/10) break;
+	}
+}
+
+
 //------------------------------------------------------------------------------------------------------
 // Code Entery
 
 
-void main(){
-	// generate fake data for testing. Should be replaced with load in from file
-	generate_data();
+// map the saved data, only generating fake data for a new data file. A data file that can't
+// be used is left alone and nothing else is opened: running from memory would lose every change
+enum DataFileState load_data(){
+	enum DataFileState data_file_state = data_file_open(DATA_FILE_PATH);
+	if (data_file_state == DATA_FILE_FAILED){
+		out_f("Not starting, changes could not be saved without the data file (move %s away to start with new data)\n",DATA_FILE_PATH);
+		return DATA_FILE_FAILED;
+	}
+	if (data_file_state == DATA_FILE_LOADED){
+		string_arena_load();
+		patient_id_index_rebuild();
+		name_index_rebuild();
+		unsigned int repaired = journal_repair_rooms();
+		if (repaired > 0) out_f("Put right %u rooms and patients left half changed by a crash\n",repaired);
+		room_indexes_rebuild();
+		user_directory_rebuild();
+	}
+	else{
+		load_default_users();
+		generate_data();
+	}
+	// the journal only describes changes to a loaded data file
+	journal_open(JOURNAL_FILE_PATH,data_file_state == DATA_FILE_LOADED);
+	// after the replay, those changes were audited when they were first made
+	if (audit_open(AUDIT_FILE_PATH)==0) out_s("Failed to open the audit file, changes won't be audited");
+	// the history of an older data file doesn't belong to newly generated data
+	if (history_open(HISTORY_FILE_PATH,HISTORY_OPEN_FILE_PATH,data_file_state == DATA_FILE_LOADED)==0)
+		out_s("Failed to open the status history file, status changes won't be kept");
+	// count what is there once, changes from here on keep the counters up to date
+	census_rebuild();
+	return data_file_state;
+}
+
+void save_data(){
+	audit_close();
+	history_close();
+	journal_close();
+	data_file_close();
+}
+
+// usage: hospital [--quiet] [--stats <file>] [--batch [file] | --import <rooms|patients|users> <file>
+//                  | --serve [socket path or port] [--replicate <socket path>]
+//                  | --standby <primary's socket path> [socket path or port] [--replicate <socket path>]
+//                  | --bench [max records] [seed] | --audit [file]]
+void main(int argc, char *argv[]){
+	atexit(out_flush);
+	stats.started = time(NULL);
+	// leave out decorations, for scripts reading the output
+	if (argc >= 2 && strcmp(argv[1],"--quiet")==0){
+		output.quiet = 1;
+		argc--;
+		argv++;
+	}
+	// keep a file with the operation statistics up to date
+	if (argc >= 3 && strcmp(argv[1],"--stats")==0){
+		stats_start_dump(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+
+	// benchmarks run on generated data only, away from the data file
+	if (argc >= 2 && strcmp(argv[1],"--bench")==0){
+		unsigned int max_records = BENCH_DEFAULT_MAX_RECORDS;
+		unsigned int seed = BENCH_DEFAULT_SEED;
+		if (argc >= 3 && parse_id(argv[2],&max_records)==0) max_records = BENCH_DEFAULT_MAX_RECORDS;
+		if (argc >= 4 && parse_id(argv[3],&seed)==0) seed = BENCH_DEFAULT_SEED;
+		run_benchmarks(max_records,seed);
+		exit(0);
+	}
+
+	// ship the journal to standbys from a server, or from a standby once it is promoted
+	char *replicate_path = NULL;
+	if (argc >= 4 && strcmp(argv[argc-2],"--replicate")==0){
+		replicate_path = argv[argc-1];
+		argc -= 2;
+	}
+
+	// follow a primary, starting from a snapshot of its data instead of the data here
+	if (argc >= 3 && strcmp(argv[1],"--standby")==0){
+		if (standby_start(argv[2],replicate_path)==0) exit(1);
+		run_server(argc >= 4 ? argv[3] : SERVER_DEFAULT_SOCKET);
+		replication_stop();
+		save_data();
+		exit(0);
+	}
+
+	// print the audit trail instead of opening the data
+	if (argc >= 2 && strcmp(argv[1],"--audit")==0){
+		char *path = argc >= 3 ? argv[2] : AUDIT_FILE_PATH;
+		if (audit_print(path)==0){
+			out_f("Failed to open %s\n",path);
+			exit(1);
+		}
+		exit(0);
+	}
+
+	if (load_data() == DATA_FILE_FAILED) exit(1);
+
+	// serve the commands to many clients at once until stopped with a signal
+	if (argc >= 2 && strcmp(argv[1],"--serve")==0){
+		if (replicate_path != NULL && replication_start(replicate_path)==0) out_f("Failed to replicate on %s\n",replicate_path);
+		run_server(argc >= 3 ? argv[2] : SERVER_DEFAULT_SOCKET);
+		replication_stop();
+		save_data();
+		exit(0);
+	}
+
+	// load rooms, patients or users from a comma or tab separated file
+	if (argc == 4 && strcmp(argv[1],"--import")==0){
+		unsigned int rejected = 1;
+		for (int i=IMPORT_ROOMS; i<=IMPORT_USERS; i++){
+			if (strcmp(argv[2],ImportKindToS[i])==0) rejected = import_file(i,argv[3]);
+		}
+		if (rejected == 1 && strcmp(argv[2],"rooms")!=0 && strcmp(argv[2],"patients")!=0 && strcmp(argv[2],"users")!=0)
+			out_s("Import must be one of rooms, patients or users");
+		save_data();
+		exit(rejected == 0 ? 0 : 1);
+	}
+
+	// run commands from a file (or stdin) instead of the menus
+	if (argc >= 2 && strcmp(argv[1],"--batch")==0){
+		unsigned int failed = run_batch(argc >= 3 ? argv[2] : NULL);
+		save_data();
+		exit(failed == 0 ? 0 : 1);
+	}
 
 	// main loop, allows for consequtive sessions
-	struct User user;
+	struct User *user;
 	while (0==0){
 		// login required to start session
 		user = login_loop();
-		if (user.privilege == NOPRV){
+		if (user->privilege == NOPRV){
 			// exit application if not logged in
 			break;
 		}
 		// enter session loop
 		session_loop(user);
+		audit_actor[0] = 0;
+		journal_commit();
 	}
+	save_data();
 }
\ No newline at end of file